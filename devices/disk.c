@@ -48,6 +48,10 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* Most sectors a single READ or WRITE SECTOR command can move.
+   The sector count register is 8 bits wide, with 0 meaning 256. */
+#define MAX_SECTORS_PER_CMD 256
+
 /* An ATA device. */
 struct disk 
   {
@@ -86,7 +90,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t sec_cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -226,7 +230,7 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
 
   c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sector (d, sec_no, 1);
   issue_pio_command (c, CMD_READ_SECTOR_RETRY);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
@@ -251,7 +255,7 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
 
   c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sector (d, sec_no, 1);
   issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
   if (!wait_while_busy (d))
     PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
@@ -260,6 +264,94 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
   d->write_cnt++;
   lock_release (&c->lock);
 }
+
+/* Reads the SEC_CNT consecutive sectors starting at SEC_NO from
+   disk D.  Sector SEC_NO + I is stored into BUFFERS[I], which
+   must have room for DISK_SECTOR_SIZE bytes.  Up to
+   MAX_SECTORS_PER_CMD sectors are requested with a single
+   command, so the disk sees one request instead of SEC_CNT.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t sec_cnt,
+                    void *const buffers[])
+{
+  struct channel *c;
+  size_t i = 0;
+
+  ASSERT (d != NULL);
+  ASSERT (buffers != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+  while (i < sec_cnt)
+    {
+      size_t cmd_cnt = sec_cnt - i;
+      size_t j;
+
+      if (cmd_cnt > MAX_SECTORS_PER_CMD)
+        cmd_cnt = MAX_SECTORS_PER_CMD;
+      select_sector (d, sec_no + i, cmd_cnt);
+      issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+
+      /* The disk interrupts once as each sector becomes ready. */
+      for (j = 0; j < cmd_cnt; j++, i++)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          ASSERT (buffers[i] != NULL);
+          input_sector (c, buffers[i]);
+          d->read_cnt++;
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes the SEC_CNT consecutive sectors starting at SEC_NO to
+   disk D.  Sector SEC_NO + I is written from BUFFERS[I], which
+   must contain DISK_SECTOR_SIZE bytes.  As disk_read_multiple(),
+   moves up to MAX_SECTORS_PER_CMD sectors per command.  Returns
+   after the disk has acknowledged receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t sec_cnt,
+                     const void *const buffers[])
+{
+  struct channel *c;
+  size_t i = 0;
+
+  ASSERT (d != NULL);
+  ASSERT (buffers != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+  while (i < sec_cnt)
+    {
+      size_t cmd_cnt = sec_cnt - i;
+      size_t j;
+
+      if (cmd_cnt > MAX_SECTORS_PER_CMD)
+        cmd_cnt = MAX_SECTORS_PER_CMD;
+      select_sector (d, sec_no + i, cmd_cnt);
+      issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+
+      /* The disk interrupts once it has taken each sector. */
+      for (j = 0; j < cmd_cnt; j++, i++)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          ASSERT (buffers[i] != NULL);
+          output_sector (c, buffers[i]);
+          sema_down (&c->completion_wait);
+          d->write_cnt++;
+        }
+    }
+  lock_release (&c->lock);
+}
 
 /* Disk detection and identification. */
 
@@ -426,18 +518,19 @@ print_ata_string (char *string, size_t size)
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and SEC_CNT to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) 
+select_sector (struct disk *d, disk_sector_t sec_no, size_t sec_cnt) 
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < d->capacity);
+  ASSERT (sec_cnt > 0 && sec_cnt <= MAX_SECTORS_PER_CMD);
+  ASSERT (sec_no + sec_cnt <= d->capacity);
   ASSERT (sec_no < (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), sec_cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -289,6 +289,36 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's bit count if there is no such bit.
+   Examines a whole element at a time, so runs of bits that are
+   all !VALUE are skipped ELEM_BITS at a time. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) 
+{
+  size_t elem_total = elem_cnt (b->bit_cnt);
+  size_t i = elem_idx (start);
+  elem_type e;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  /* Look only at bits at or after START in the first element. */
+  e = value ? b->bits[i] : ~b->bits[i];
+  e &= (elem_type) -1 << (start % ELEM_BITS);
+  for (;;) 
+    {
+      if (e != 0) 
+        {
+          size_t idx = i * ELEM_BITS + __builtin_ctzl (e);
+          return idx < b->bit_cnt ? idx : b->bit_cnt;
+        }
+      if (++i >= elem_total)
+        return b->bit_cnt;
+      e = value ? b->bits[i] : ~b->bits[i];
+    }
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -299,13 +329,23 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump to the next VALUE bit, then to the end of the run of
+         VALUE bits that starts there.  The run is either long
+         enough or we resume the search just past it. */
+      while ((i = find_next (b, i, value)) <= last)
+        {
+          size_t end = find_next (b, i, !value);
+          if (end - i >= cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -0,0 +1,37 @@
+/* Child process of page-large-seq.
+   Writes a pattern based on its argument across an 8 MB array,
+   which holds at least one whole aligned 4 MB span and so may be
+   mapped with large pages, then checks that it is all there and
+   exits with its argument as the exit code. */
+
+#include <stdlib.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+const char *test_name = "child-large";
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 2048
+#define WORD_CNT (PAGE_SIZE / sizeof (int))
+
+static int big[PAGE_CNT][WORD_CNT];
+
+int
+main (int argc, char *argv[])
+{
+  int key = atoi (argv[argc - 1]);
+  int page;
+  size_t i;
+
+  for (page = 0; page < PAGE_CNT; page++)
+    for (i = 0; i < WORD_CNT; i += 97)
+      big[page][i] = page * 7 + key + (int) i;
+
+  for (page = 0; page < PAGE_CNT; page++)
+    for (i = 0; i < WORD_CNT; i += 97)
+      if (big[page][i] != page * 7 + key + (int) i)
+        fail ("page %d, word %zu is %d (should be %d)", page, i,
+              big[page][i], page * 7 + key + (int) i);
+
+  return key;
+}
@@ -0,0 +1,58 @@
+/* Forks a child that checks that it sees the parent's data and
+   stack, then overwrites both, partly by reading a file into
+   them, and verifies that the parent's copies are unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (4 * 4096)
+
+static char buf[SIZE];
+
+/* Fails unless the SIZE bytes at P all equal C. */
+static void
+check_fill (const char *p, size_t size, char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != c)
+      fail ("%s: byte %zu is %02hhx (should be %02hhx)", who, i, p[i], c);
+}
+
+void
+test_main (void)
+{
+  char stack[4096];
+  int handle;
+  pid_t child;
+
+  memset (buf, 'a', sizeof buf);
+  memset (stack, 's', sizeof stack);
+
+  child = fork ();
+  if (child == 0)
+    {
+      check_fill (buf, sizeof buf, 'a', "child data");
+      check_fill (stack, sizeof stack, 's', "child stack");
+
+      memset (buf, 'b', sizeof buf);
+      memset (stack, 't', sizeof stack);
+      CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+      CHECK (read (handle, buf + 4096, sizeof sample - 1)
+             == (int) sizeof sample - 1, "read \"sample.txt\"");
+      if (memcmp (buf + 4096, sample, sizeof sample - 1))
+        fail ("child read bad data");
+      exit (42);
+    }
+  if (child == -1)
+    fail ("fork");
+
+  CHECK (wait (child) == 42, "wait for child");
+  check_fill (buf, sizeof buf, 'a', "parent data");
+  check_fill (stack, sizeof stack, 's', "parent stack");
+  msg ("parent's memory is unchanged");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) open "sample.txt"
+(fork-cow) read "sample.txt"
+fork-cow: exit(42)
+(fork-cow) wait for child
+(fork-cow) parent's memory is unchanged
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
@@ -0,0 +1,76 @@
+/* Gives each page of a 2 MB buffer its own contents, then
+   strides through the cold part of the buffer rewriting pages
+   while repeatedly checking a small hot set, so that the
+   replacement policy has to evict and reload pages over and over.
+   Verifies that every page still holds what was last written to
+   it.  The tests that use this run it under different replacement
+   policies. */
+
+#include "tests/vm/hot-cold.h"
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 512
+#define HOT_CNT 16
+#define ROUND_CNT 8
+#define STRIDE 7
+
+#define WORD_CNT (PAGE_SIZE / sizeof (uint32_t))
+
+static uint32_t buf[PAGE_CNT][WORD_CNT];
+static uint8_t versions[PAGE_CNT];
+
+/* Returns word I of page PAGE as of version VERSION. */
+static uint32_t
+page_word (int page, int version, size_t i)
+{
+  return (page * 0x9e3779b1u) ^ (version << 24) ^ i;
+}
+
+/* Writes version VERSION of page PAGE. */
+static void
+write_page (int page, int version)
+{
+  size_t i;
+
+  for (i = 0; i < WORD_CNT; i++)
+    buf[page][i] = page_word (page, version, i);
+  versions[page] = version;
+}
+
+/* Fails unless page PAGE holds its last written version. */
+static void
+check_page (int page)
+{
+  size_t i;
+
+  for (i = 0; i < WORD_CNT; i++)
+    if (buf[page][i] != page_word (page, versions[page], i))
+      fail ("page %d, word %zu is %08x (should be %08x)", page, i,
+            buf[page][i], page_word (page, versions[page], i));
+}
+
+void
+hot_cold (void)
+{
+  int round, page, hot;
+
+  msg ("initialize");
+  for (page = 0; page < PAGE_CNT; page++)
+    write_page (page, 0);
+
+  msg ("hot and cold passes");
+  for (round = 1; round <= ROUND_CNT; round++)
+    for (page = HOT_CNT + round % STRIDE; page < PAGE_CNT; page += STRIDE)
+      {
+        write_page (page, round);
+        for (hot = 0; hot < HOT_CNT; hot++)
+          check_page (hot);
+      }
+
+  msg ("verify");
+  for (page = 0; page < PAGE_CNT; page++)
+    check_page (page);
+}
@@ -0,0 +1,6 @@
+#ifndef TESTS_VM_HOT_COLD
+#define TESTS_VM_HOT_COLD 1
+
+void hot_cold (void);
+
+#endif /* tests/vm/hot-cold.h */
@@ -0,0 +1,62 @@
+/* Maps a file of several pages and touches its pages out of
+   order, starting in the middle, checking each one against the
+   file's contents as read with read().  Pages mapped around an
+   earlier fault must hold the right data, and the end of the last
+   page must be zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define MAX_SIZE (64 * 1024)
+
+static char expect[MAX_SIZE];
+static char *actual = (char *) 0x10000000;
+static int size;
+
+/* Fails unless page PAGE of the mapping matches the file. */
+static void
+check_page (int page)
+{
+  int ofs = page * PAGE_SIZE;
+  int len = size - ofs < PAGE_SIZE ? size - ofs : PAGE_SIZE;
+
+  if (memcmp (actual + ofs, expect + ofs, len))
+    fail ("page %d of mmap'd file reported bad data", page);
+}
+
+void
+test_main (void)
+{
+  int handle, page_cnt, page, i;
+  mapid_t map;
+
+  CHECK ((handle = open ("child-linear")) > 1, "open \"child-linear\"");
+  size = filesize (handle);
+  page_cnt = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  if (page_cnt < 8 || size > MAX_SIZE)
+    fail ("\"child-linear\" is %d bytes, outside the expected range", size);
+  CHECK (read (handle, expect, size) == size, "read \"child-linear\"");
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED,
+         "mmap \"child-linear\"");
+
+  /* Touch the middle page first, then the pages after it, which
+     fault-around should already have mapped, then the pages before
+     it in reverse. */
+  msg ("verify mapped pages");
+  for (page = page_cnt / 2; page < page_cnt; page++)
+    check_page (page);
+  for (page = page_cnt / 2 - 1; page >= 0; page--)
+    check_page (page);
+
+  /* Verify that data is followed by zeros. */
+  for (i = size; i < page_cnt * PAGE_SIZE; i++)
+    if (actual[i] != 0)
+      fail ("byte %d of mmap'd region has value %02hhx (should be 0)",
+            i, actual[i]);
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-around) begin
+(mmap-around) open "child-linear"
+(mmap-around) read "child-linear"
+(mmap-around) mmap "child-linear"
+(mmap-around) verify mapped pages
+(mmap-around) end
+mmap-around: exit(0)
+EOF
+pass;
@@ -0,0 +1,42 @@
+/* Writes to a file through a mapping and checks that read() sees
+   the change before the file is unmapped, then writes to the file
+   with write() and checks that the mapping sees that. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  static const char via_map[] = "written through the mapping";
+  static const char via_write[] = "written with write()";
+  char buf[1024];
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, via_map, strlen (via_map));
+
+  CHECK (read (handle, buf, strlen (sample)) == (int) strlen (sample),
+         "read \"sample.txt\"");
+  if (memcmp (buf, via_map, strlen (via_map)))
+    fail ("read() doesn't see write through mapping");
+  if (memcmp (buf + strlen (via_map), sample + strlen (via_map),
+              strlen (sample) - strlen (via_map)))
+    fail ("read() data differs from file past the write");
+
+  seek (handle, 100);
+  CHECK (write (handle, via_write, strlen (via_write))
+         == (int) strlen (via_write), "write \"sample.txt\"");
+  if (memcmp (ACTUAL + 100, via_write, strlen (via_write)))
+    fail ("mapping doesn't see write()");
+
+  munmap (map);
+  close (handle);
+}
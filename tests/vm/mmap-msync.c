@@ -0,0 +1,45 @@
+/* Writes to a file through a mapping, flushes it with msync(),
+   gives each kind of madvise() advice, and checks that the data
+   survives having its frames dropped and loaded again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  static const char overwrite[] = "synced through the mapping";
+  char buf[1024];
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, overwrite, strlen (overwrite));
+  memcpy (buf, sample, strlen (sample));
+  memcpy (buf, overwrite, strlen (overwrite));
+
+  CHECK (msync (map), "msync");
+  CHECK (!msync (map + 1), "msync of bad mapping fails");
+
+  CHECK (madvise (map, MADV_SEQUENTIAL), "madvise sequential");
+  CHECK (madvise (map, MADV_RANDOM), "madvise random");
+  CHECK (madvise (map, MADV_NORMAL), "madvise normal");
+  CHECK (madvise (map, MADV_DONTNEED), "madvise dontneed");
+  if (memcmp (ACTUAL, buf, strlen (sample)))
+    fail ("data lost after MADV_DONTNEED");
+  CHECK (madvise (map, MADV_DONTNEED), "madvise dontneed");
+  CHECK (madvise (map, MADV_WILLNEED), "madvise willneed");
+  if (memcmp (ACTUAL, buf, strlen (sample)))
+    fail ("data lost after MADV_WILLNEED");
+  CHECK (!madvise (map, 99), "madvise with bad advice fails");
+
+  munmap (map);
+  CHECK (!msync (map), "msync after munmap fails");
+  close (handle);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-msync) begin
+(mmap-msync) open "sample.txt"
+(mmap-msync) mmap "sample.txt"
+(mmap-msync) msync
+(mmap-msync) msync of bad mapping fails
+(mmap-msync) madvise sequential
+(mmap-msync) madvise random
+(mmap-msync) madvise normal
+(mmap-msync) madvise dontneed
+(mmap-msync) madvise dontneed
+(mmap-msync) madvise willneed
+(mmap-msync) madvise with bad advice fails
+(mmap-msync) msync after munmap fails
+(mmap-msync) end
+EOF
+pass;
@@ -0,0 +1,13 @@
+/* Runs the hot and cold page test under the two-handed clock,
+   with its hands only a few frames apart, so that pages get
+   little time to be touched again before the back hand comes
+   round. */
+
+#include "tests/main.h"
+#include "tests/vm/hot-cold.h"
+
+void
+test_main (void)
+{
+  hot_cold ();
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-2hand-hs) begin
+(page-2hand-hs) initialize
+(page-2hand-hs) hot and cold passes
+(page-2hand-hs) verify
+(page-2hand-hs) end
+EOF
+pass;
@@ -0,0 +1,11 @@
+/* Runs the hot and cold page test under the two-handed clock,
+   with its hands the default distance apart. */
+
+#include "tests/main.h"
+#include "tests/vm/hot-cold.h"
+
+void
+test_main (void)
+{
+  hot_cold ();
+}
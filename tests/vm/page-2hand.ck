@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-2hand) begin
+(page-2hand) initialize
+(page-2hand) hot and cold passes
+(page-2hand) verify
+(page-2hand) end
+EOF
+pass;
@@ -0,0 +1,11 @@
+/* Runs the hot and cold page test under the single-handed
+   second chance clock. */
+
+#include "tests/main.h"
+#include "tests/vm/hot-cold.h"
+
+void
+test_main (void)
+{
+  hot_cold ();
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-clock) begin
+(page-clock) initialize
+(page-clock) hot and cold passes
+(page-clock) verify
+(page-clock) end
+EOF
+pass;
@@ -0,0 +1,27 @@
+/* Runs child-large several times, one after another.  Each child
+   maps its 8 MB array with large pages only if the page allocator
+   has merged the 4 kB frames the child before it freed back into
+   an aligned 4 MB block. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+
+void
+test_main (void)
+{
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      char cmd[32];
+      pid_t child;
+
+      snprintf (cmd, sizeof cmd, "child-large %d", i);
+      CHECK ((child = exec (cmd)) != -1, "exec \"%s\"", cmd);
+      CHECK (wait (child) == i, "wait for child %d", i);
+    }
+}
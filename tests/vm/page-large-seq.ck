@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-large-seq) begin
+(page-large-seq) exec "child-large 0"
+child-large: exit(0)
+(page-large-seq) wait for child 0
+(page-large-seq) exec "child-large 1"
+child-large: exit(1)
+(page-large-seq) wait for child 1
+(page-large-seq) exec "child-large 2"
+child-large: exit(2)
+(page-large-seq) wait for child 2
+(page-large-seq) exec "child-large 3"
+child-large: exit(3)
+(page-large-seq) wait for child 3
+(page-large-seq) end
+page-large-seq: exit(0)
+EOF
+pass;
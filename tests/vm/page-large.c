@@ -0,0 +1,85 @@
+/* Fills an 8 MB array, which holds at least one whole aligned
+   4 MB span and so may be mapped with large pages, reads a file
+   into the middle of it, then forks a child that checks and
+   overwrites part of it, and verifies that the parent's copy is
+   unchanged.  The child's writes make the kernel split any large
+   page back into 4 kB pages to share them copy-on-write. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 2048
+#define WORD_CNT (PAGE_SIZE / sizeof (int))
+#define READ_PAGE (PAGE_CNT / 2 + 3)
+
+static int big[PAGE_CNT][WORD_CNT];
+
+/* Fails unless page PAGE of big[] holds what was written to it
+   for VERSION, or the file data for READ_PAGE. */
+static void
+check_page (int page, int version, const char *who)
+{
+  size_t i;
+
+  if (page == READ_PAGE)
+    {
+      if (memcmp (big[page], sample, sizeof sample - 1))
+        fail ("%s: page %d has bad file data", who, page);
+      return;
+    }
+  for (i = 0; i < WORD_CNT; i += 97)
+    if (big[page][i] != page * 7 + version + (int) i)
+      fail ("%s: page %d, word %zu is %d (should be %d)", who, page, i,
+            big[page][i], page * 7 + version + (int) i);
+}
+
+/* Writes VERSION of page PAGE of big[]. */
+static void
+write_page (int page, int version)
+{
+  size_t i;
+
+  for (i = 0; i < WORD_CNT; i += 97)
+    big[page][i] = page * 7 + version + (int) i;
+}
+
+void
+test_main (void)
+{
+  int handle, page;
+  pid_t child;
+
+  msg ("initialize");
+  for (page = 0; page < PAGE_CNT; page++)
+    write_page (page, 0);
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (handle, big[READ_PAGE], sizeof sample - 1)
+         == (int) sizeof sample - 1, "read \"sample.txt\"");
+  close (handle);
+
+  child = fork ();
+  if (child == 0)
+    {
+      for (page = 0; page < PAGE_CNT; page++)
+        check_page (page, 0, "child");
+      for (page = 0; page < PAGE_CNT; page += 61)
+        if (page != READ_PAGE)
+          {
+            write_page (page, 1);
+            check_page (page, 1, "child");
+          }
+      exit (42);
+    }
+  if (child == -1)
+    fail ("fork");
+
+  CHECK (wait (child) == 42, "wait for child");
+  for (page = 0; page < PAGE_CNT; page++)
+    check_page (page, 0, "parent");
+  msg ("parent's memory is unchanged");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-large) begin
+(page-large) initialize
+(page-large) open "sample.txt"
+(page-large) read "sample.txt"
+page-large: exit(42)
+(page-large) wait for child
+(page-large) parent's memory is unchanged
+(page-large) end
+page-large: exit(0)
+EOF
+pass;
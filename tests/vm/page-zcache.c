@@ -0,0 +1,75 @@
+/* Fills 2 MB of memory with a mix of zero, compressible, and
+   random pages, then verifies and rewrites it several times, so
+   that pages are evicted to and reloaded from the compressed
+   swap cache, the zero-page path, and the swap disk alike.  Each
+   pass changes which kind of contents each page holds. */
+
+#include <stdint.h>
+#include <string.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 512
+#define PASS_CNT 3
+
+static char buf[PAGE_CNT][PAGE_SIZE];
+static char expect[PAGE_SIZE];
+
+/* Fills P with the contents of page PAGE in pass PASS. */
+static void
+fill_page (char *p, int page, int pass)
+{
+  static const char text[] = "all work and no play makes jack ";
+  uint32_t *w = (uint32_t *) p;
+  struct arc4 arc4;
+  int key[2];
+  size_t i;
+
+  switch ((page + pass) % 4)
+    {
+    case 0:
+      memset (p, 0, PAGE_SIZE);
+      break;
+
+    case 1:
+      for (i = 0; i < PAGE_SIZE; i++)
+        p[i] = i % 64 < 4 ? page + pass : text[i % 32];
+      break;
+
+    case 2:
+      for (i = 0; i < PAGE_SIZE / sizeof *w; i++)
+        w[i] = (page << 16) | (pass << 8) | (i % 256);
+      break;
+
+    case 3:
+      key[0] = page;
+      key[1] = pass;
+      memset (p, 0, PAGE_SIZE);
+      arc4_init (&arc4, key, sizeof key);
+      arc4_crypt (&arc4, p, PAGE_SIZE);
+      break;
+    }
+}
+
+void
+test_main (void)
+{
+  int pass, page;
+
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      msg ("write pass %d", pass);
+      for (page = 0; page < PAGE_CNT; page++)
+        fill_page (buf[page], page, pass);
+
+      msg ("read pass %d", pass);
+      for (page = 0; page < PAGE_CNT; page++)
+        {
+          fill_page (expect, page, pass);
+          if (memcmp (buf[page], expect, PAGE_SIZE))
+            fail ("page %d differs in pass %d", page, pass);
+        }
+    }
+}
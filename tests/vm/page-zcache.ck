@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zcache) begin
+(page-zcache) write pass 0
+(page-zcache) read pass 0
+(page-zcache) write pass 1
+(page-zcache) read pass 1
+(page-zcache) write pass 2
+(page-zcache) read pass 2
+(page-zcache) end
+EOF
+pass;
@@ -17,8 +17,10 @@
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memstat.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -35,7 +37,9 @@
 #include "filesys/fsutil.h"
 #endif
 #include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/zcache.h"
 
 /* Amount of physical memory, in 4 kB pages. */
 size_t ram_pages;
@@ -51,8 +55,18 @@ static bool format_filesys;
 /* -q: Power off after kernel tasks complete? */
 bool power_off_when_done;
 
+/* -lp: Map memory with 4 MB pages where possible? */
+bool large_pages;
+
+/* CPUID feature flags, in EDX of leaf 1, and CR4 bits. */
+#define CPUID_PSE 0x00000008    /* Page Size Extension. */
+#define CPUID_PGE 0x00002000    /* Page Global Enable. */
+#define CR4_PSE 0x00000010      /* Page Size Extension enable. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
 static void ram_init (void);
 static void paging_init (void);
+static uint32_t cpu_features (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -88,6 +102,7 @@ main (void)
   /* Initialize memory system. */
   palloc_init ();
   malloc_init ();
+  memstat_init ();
   paging_init ();
 
   /* Segmentation. */
@@ -108,6 +123,8 @@ main (void)
 
   /* Start thread scheduler and enable interrupts. */
   ft_init ();
+  page_init ();
+  vma_init ();
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
@@ -119,6 +136,8 @@ main (void)
 #endif
 
   swap_init();
+  zcache_init ();
+  ft_start_pageout ();
 
   printf ("Boot complete.\n");
   
@@ -156,13 +175,41 @@ ram_init (void)
    At the time this function is called, the active page table
    (set up by loader.S) only maps the first 4 MB of RAM, so we
    should not try to use extravagant amounts of memory.
-   Fortunately, there is no need to do so. */
+   Fortunately, there is no need to do so.
+
+   With -lp, each whole 4 MB of RAM clear of the kernel's text is
+   mapped by a single page directory entry instead of a page
+   table, if the CPU supports it.  That takes a TLB entry per 4 MB
+   of kernel memory instead of one per 4 kB, and saves the page
+   table.  Big user regions may then use 4 MB pages too; see
+   vma_map_large().  The kernel's text stays in 4 kB pages so that
+   it can still be read-only.
+
+   If the CPU supports global pages, the kernel mappings, which
+   are the same in every page directory, are marked global, so
+   that their TLB entries survive the CR3 reload on a switch to
+   another process. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool global_pages = (cpu_features () & CPUID_PGE) != 0;
+  uint32_t global = global_pages ? PTE_G : 0;
+
+  if (large_pages && !(cpu_features () & CPUID_PSE))
+    {
+      printf ("CPU lacks 4 MB pages, using 4 kB pages.\n");
+      large_pages = false;
+    }
+  if (large_pages)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_PSE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
 
   pd = base_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -174,13 +221,22 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (large_pages && pte_idx == 0
+          && page + (PTSPAN / PGSIZE) <= ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large_kernel (vaddr, true) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -189,6 +245,25 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (base_page_dir)));
+
+  if (global_pages)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_PGE;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+}
+
+/* Returns the CPU's feature flags, as reported in EDX by CPUID
+   leaf 1.  See [IA32-v2a] "CPUID--CPU Identification". */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -249,9 +324,30 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-lp"))
+        large_pages = true;
+      else if (!strcmp (name, "-ml"))
+        memstat_ledger = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-sl"))
+        stack_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-zc"))
+        zcache_page_limit = atoi (value);
+      else if (!strcmp (name, "-rp"))
+        {
+          if (!strcmp (value, "clock"))
+            ft_policy = FT_CLOCK;
+          else if (!strcmp (value, "2hand"))
+            ft_policy = FT_TWO_HANDED;
+          else
+            PANIC ("unknown replacement policy `%s'", value);
+        }
+      else if (!strcmp (name, "-hs"))
+        ft_hand_spread = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -354,8 +450,16 @@ usage (void)
           "  -f                 Format file system disk during startup.\n"
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -lp                Use 4 MB pages for the kernel and big regions.\n"
+          "  -ml                List kernel allocations not freed by shutdown.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -sl=COUNT          Limit user stacks to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -zc=COUNT          Limit compressed swap cache to COUNT pages.\n"
+          "  -rp=POLICY         Use page replacement POLICY, clock or 2hand.\n"
+          "  -hs=COUNT          Space the 2hand clock's hands COUNT frames apart.\n"
 #endif
           );
   power_off ();
@@ -392,6 +496,10 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  malloc_print_stats ();
+  slab_print_stats ();
+  memstat_print_ledger ();
 #ifdef FILESYS
   disk_print_stats ();
 #endif
@@ -400,4 +508,7 @@ print_stats (void)
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  zcache_print_stats ();
+#endif
 }
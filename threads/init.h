@@ -15,6 +15,9 @@ extern uint32_t *base_page_dir;
 /* -q: Power off when kernel tasks complete? */
 extern bool power_off_when_done;
 
+/* -lp: Map memory with 4 MB pages where possible? */
+extern bool large_pages;
+
 void power_off (void) NO_RETURN;
 
 #endif /* threads/init.h */
@@ -5,8 +5,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
+#include "threads/memstat.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -28,6 +31,20 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   Each thread also keeps a "magazine" of free blocks for each
+   descriptor, a short stack linked through the blocks
+   themselves.  malloc() pops a block off the running thread's
+   magazine and free() pushes one on, neither taking the
+   descriptor's lock.  Only when a magazine runs empty or full
+   are MAG_BATCH blocks moved between it and the descriptor's
+   free list, under one acquisition of the lock.  Blocks in a
+   magazine count as in use as far as their arena is concerned,
+   and a thread's magazines are drained when it exits.  The
+   magazine also counts the blocks handed out and taken back,
+   which are added to the descriptor's statistics at the same
+   times.  Magazines belong to threads, so malloc() and free()
+   must not be called from an interrupt handler.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
@@ -41,6 +58,7 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    struct memstat stats;       /* Blocks handed out. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -61,11 +79,23 @@ struct block
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_CLASS_CNT]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Pages handed out in big blocks. */
+static struct memstat big_stats;
+
+/* Most blocks a magazine holds, and the number moved between a
+   magazine and its descriptor's free list at a time. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *malloc_from (size_t, const void *caller);
+static bool mag_refill (struct desc *, struct magazine *);
+static void mag_drain (struct desc *, struct magazine *, size_t cnt);
+static void mag_fold_stats (struct desc *, struct magazine *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -82,17 +112,28 @@ malloc_init (void)
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
+  ASSERT (desc_cnt == MALLOC_CLASS_CNT);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return malloc_from (size, __builtin_return_address (0));
+}
+
+/* Does the work of malloc() for the code at CALLER. */
+static void *
+malloc_from (size_t size, const void *caller) 
 {
   struct desc *d;
+  struct magazine *mag;
   struct block *b;
   struct arena *a;
 
+  ASSERT (!intr_context ());
+
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
@@ -109,47 +150,34 @@ malloc (size_t size)
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
       if (a == NULL)
-        return NULL;
+        {
+          memstat_fail (&big_stats);
+          return NULL;
+        }
 
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      memstat_alloc (&big_stats, page_cnt);
+      memstat_track (a + 1, PGSIZE * page_cnt - sizeof *a, caller);
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  /* Take a block from the running thread's magazine, filling it
+     up first if it is empty. */
+  mag = &thread_current ()->magazines[d - descs];
+  if (mag->cnt == 0 && !mag_refill (d, mag))
     {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
+      memstat_fail (&d->stats);
+      return NULL;
     }
-
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  b = mag->top;
+  mag->top = *(void **) b;
+  mag->cnt--;
+  mag->alloc_cnt++;
+  memstat_track (b, d->block_size, caller);
   return b;
 }
 
@@ -167,7 +195,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_from (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -201,7 +229,7 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_from (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -218,6 +246,8 @@ realloc (void *old_block, size_t new_size)
 void
 free (void *p) 
 {
+  ASSERT (!intr_context ());
+
   if (p != NULL)
     {
       struct block *b = p;
@@ -227,42 +257,177 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct magazine *mag = &thread_current ()->magazines[d - descs];
+
+          mag->free_cnt++;
+          memstat_untrack (b);
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
 
-          lock_release (&d->lock);
+          /* Push the block on the running thread's magazine, first
+             making room if it is full. */
+          if (mag->cnt >= MAG_SIZE)
+            mag_drain (d, mag, MAG_BATCH);
+          *(void **) b = mag->top;
+          mag->top = b;
+          mag->cnt++;
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          memstat_free (&big_stats, a->free_cnt);
+          memstat_untrack (b);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Prints malloc() statistics for each block size in use.  Only
+   the running thread's magazines are counted up to the moment;
+   other threads' latest blocks show up once they next refill or
+   drain a magazine. */
+void
+malloc_print_stats (void) 
+{
+  struct magazine *mags = thread_current ()->magazines;
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    {
+      lock_acquire (&d->lock);
+      mag_fold_stats (d, &mags[d - descs]);
+      lock_release (&d->lock);
+    }
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->stats.alloc_cnt > 0)
+      {
+        char what[32];
+        snprintf (what, sizeof what, "Malloc %zu", d->block_size);
+        memstat_print (what, "blocks", &d->stats);
+      }
+  if (big_stats.alloc_cnt > 0)
+    memstat_print ("Malloc big", "pages", &big_stats);
+}
+
+/* Returns the running thread's cached free blocks to their
+   descriptors' free lists.  Called when the thread exits. */
+void
+malloc_drain (void) 
+{
+  struct magazine *mags = thread_current ()->magazines;
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    mag_drain (&descs[i], &mags[i], mags[i].cnt);
+}
+
+/* Moves up to MAG_BATCH blocks from D's free list to magazine MAG,
+   which belongs to D, creating a new arena if the free list is
+   empty.  Returns false if no block could be had. */
+static bool
+mag_refill (struct desc *d, struct magazine *mag) 
+{
+  size_t i;
+
+  lock_acquire (&d->lock);
+  mag_fold_stats (d, mag);
+  for (i = 0; i < MAG_BATCH; i++)
+    {
+      struct block *b;
+      struct arena *a;
+
+      /* If the free list is empty, create a new arena, unless we
+         already have some blocks. */
+      if (list_empty (&d->free_list))
+        {
+          size_t j;
+
+          if (i > 0)
+            break;
+
+          /* Allocate a page. */
+          a = palloc_get_page (0);
+          if (a == NULL) 
+            {
+              lock_release (&d->lock);
+              return false;
+            }
+
+          /* Initialize arena and add its blocks to the free list. */
+          a->magic = ARENA_MAGIC;
+          a->desc = d;
+          a->free_cnt = d->blocks_per_arena;
+          for (j = 0; j < d->blocks_per_arena; j++) 
+            {
+              b = arena_to_block (a, j);
+              list_push_back (&d->free_list, &b->free_elem);
+            }
+        }
+
+      /* Move a block from the free list to the magazine. */
+      b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+      a = block_to_arena (b);
+      a->free_cnt--;
+      *(void **) b = mag->top;
+      mag->top = b;
+      mag->cnt++;
+    }
+  lock_release (&d->lock);
+  return true;
+}
+
+/* Moves CNT blocks from magazine MAG to its descriptor D's free
+   list, giving back to the page allocator any arena that is left
+   with no block in use. */
+static void
+mag_drain (struct desc *d, struct magazine *mag, size_t cnt) 
+{
+  ASSERT (cnt <= mag->cnt);
+
+  lock_acquire (&d->lock);
+  mag_fold_stats (d, mag);
+  for (; cnt > 0; cnt--)
+    {
+      struct block *b = mag->top;
+      struct arena *a = block_to_arena (b);
+
+      mag->top = *(void **) b;
+      mag->cnt--;
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t i;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (i = 0; i < d->blocks_per_arena; i++) 
+            {
+              struct block *b = arena_to_block (a, i);
+              list_remove (&b->free_elem);
+            }
+          palloc_free_page (a);
+        }
+    }
+  lock_release (&d->lock);
+}
+
+/* Adds the blocks magazine MAG, which belongs to D, has handed
+   out and taken back since it was last folded in to D's
+   statistics.  D's lock must be held. */
+static void
+mag_fold_stats (struct desc *d, struct magazine *mag) 
+{
+  memstat_add (&d->stats, mag->alloc_cnt, mag->free_cnt);
+  mag->alloc_cnt = mag->free_cnt = 0;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
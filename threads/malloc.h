@@ -4,10 +4,24 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Number of malloc() size classes, 16 bytes up to 1 kB. */
+#define MALLOC_CLASS_CNT 7
+
+/* A thread's cache of free blocks of one size class. */
+struct magazine
+  {
+    void *top;                  /* Most recently freed block. */
+    size_t cnt;                 /* Number of blocks. */
+    long long alloc_cnt;        /* Blocks handed out since last fold. */
+    long long free_cnt;         /* Blocks taken back since last fold. */
+  };
+
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+void malloc_drain (void);
+void malloc_print_stats (void);
 
 #endif /* threads/malloc.h */
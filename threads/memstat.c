@@ -0,0 +1,253 @@
+#include "threads/memstat.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Kernel memory statistics.
+
+   The page allocator, malloc() and the object caches each keep a
+   struct memstat per pool, size class or cache, counting the
+   units (pages, blocks or objects) in use now and at most, and
+   the allocations that succeeded and failed.  The counters are
+   updated with interrupts off, since palloc_free_page() takes no
+   lock; that is cheap next to the allocation itself.  malloc()'s
+   fast path is cheaper still, so it only counts in the running
+   thread's magazine, and the counts are added in with
+   memstat_add() when the magazine next goes to its descriptor.
+
+   The ledger, enabled with -ml, additionally tags each
+   allocation with the address of the code that asked for it, in
+   a hash table from block to call site, and at shutdown lists
+   every call site with allocations it never freed.  The
+   addresses can be turned into function names and line numbers
+   with the "backtrace" utility, as for a panic's call stack. */
+
+bool memstat_ledger;
+
+/* A place in the kernel that allocates memory. */
+struct site
+  {
+    const void *caller;         /* Return address of the allocation. */
+    size_t cur_cnt;             /* Allocations outstanding. */
+    size_t cur_bytes;           /* Bytes outstanding. */
+    long long alloc_cnt;        /* Allocations ever made. */
+  };
+
+/* An outstanding allocation. */
+struct entry
+  {
+    const void *block;          /* Allocated block, or null if unused. */
+    size_t bytes;               /* Size of BLOCK. */
+    unsigned site;              /* Index in sites[]. */
+  };
+
+/* Call sites. */
+#define SITE_CNT 128
+static struct site sites[SITE_CNT];
+static size_t site_cnt;
+
+/* Hash table of outstanding allocations, with linear probing.
+   Its size is a power of 2. */
+#define LEDGER_PAGES 32
+static struct entry *entries;
+static size_t entry_cnt;                /* Number of slots. */
+static size_t used_cnt;                 /* Slots in use. */
+static long long untracked_cnt;         /* Allocations that didn't fit. */
+
+/* Sets up the ledger, if it is enabled.  Allocations made before
+   this is called aren't tracked, and freeing them is ignored. */
+void
+memstat_init (void) 
+{
+  size_t i;
+
+  if (!memstat_ledger)
+    return;
+
+  entries = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, LEDGER_PAGES);
+  for (i = 1; i * 2 <= LEDGER_PAGES * PGSIZE / sizeof *entries; i *= 2)
+    continue;
+  entry_cnt = i;
+}
+
+/* Records the allocation of UNITS units in S. */
+void
+memstat_alloc (struct memstat *s, size_t units) 
+{
+  enum intr_level old_level = intr_disable ();
+  s->cur += units;
+  if (s->cur > s->peak)
+    s->peak = s->cur;
+  s->alloc_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Records that UNITS units in S were freed. */
+void
+memstat_free (struct memstat *s, size_t units) 
+{
+  enum intr_level old_level = intr_disable ();
+  ASSERT (s->cur >= (long long) units);
+  s->cur -= units;
+  intr_set_level (old_level);
+}
+
+/* Records a failed allocation in S. */
+void
+memstat_fail (struct memstat *s) 
+{
+  enum intr_level old_level = intr_disable ();
+  s->fail_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Records ALLOC_CNT allocations and FREE_CNT frees of one unit
+   each in S, made since it was last updated.  The peak only sees
+   the net effect.  Units freed by one thread may be added in
+   before another thread's allocation of them is, so the count in
+   use can dip below zero for a while. */
+void
+memstat_add (struct memstat *s, long long alloc_cnt, long long free_cnt) 
+{
+  enum intr_level old_level = intr_disable ();
+  s->cur += alloc_cnt - free_cnt;
+  if (s->cur > s->peak)
+    s->peak = s->cur;
+  s->alloc_cnt += alloc_cnt;
+  intr_set_level (old_level);
+}
+
+/* Prints S, which counts UNIT, for WHAT. */
+void
+memstat_print (const char *what, const char *unit, const struct memstat *s) 
+{
+  printf ("%s: %lld %s in use, peak %lld, %lld allocated, %lld failed\n",
+          what, s->cur, unit, s->peak, s->alloc_cnt, s->fail_cnt);
+}
+
+/* Returns the first slot BLOCK hashes to. */
+static size_t
+entry_hash (const void *block) 
+{
+  return ((uintptr_t) block >> 4) * 2654435761u & (entry_cnt - 1);
+}
+
+/* Returns the index in sites[] of CALLER, adding it if it is new,
+   or SITE_CNT if there is no room. */
+static size_t
+find_site (const void *caller) 
+{
+  size_t i;
+
+  for (i = 0; i < site_cnt; i++)
+    if (sites[i].caller == caller)
+      return i;
+  if (site_cnt < SITE_CNT)
+    sites[site_cnt++].caller = caller;
+  return i;
+}
+
+/* Records in the ledger that the code at CALLER allocated BYTES
+   bytes at BLOCK. */
+void
+memstat_track (const void *block, size_t bytes, const void *caller) 
+{
+  enum intr_level old_level;
+  size_t site, i;
+
+  if (entries == NULL || block == NULL)
+    return;
+
+  old_level = intr_disable ();
+  site = find_site (caller);
+  if (site == SITE_CNT || used_cnt >= entry_cnt / 2)
+    untracked_cnt++;
+  else
+    {
+      for (i = entry_hash (block); entries[i].block != NULL;
+           i = (i + 1) & (entry_cnt - 1))
+        ASSERT (entries[i].block != block);
+      entries[i].block = block;
+      entries[i].bytes = bytes;
+      entries[i].site = site;
+      used_cnt++;
+
+      sites[site].cur_cnt++;
+      sites[site].cur_bytes += bytes;
+      sites[site].alloc_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Records in the ledger that BLOCK was freed. */
+void
+memstat_untrack (const void *block) 
+{
+  enum intr_level old_level;
+  size_t i, j;
+
+  if (entries == NULL || block == NULL)
+    return;
+
+  old_level = intr_disable ();
+  for (i = entry_hash (block); entries[i].block != NULL;
+       i = (i + 1) & (entry_cnt - 1))
+    if (entries[i].block == block)
+      {
+        struct site *s = &sites[entries[i].site];
+
+        s->cur_cnt--;
+        s->cur_bytes -= entries[i].bytes;
+        used_cnt--;
+
+        /* Move later entries of the same probe sequence back into
+           the hole, so that lookups needn't skip deleted slots. */
+        for (j = (i + 1) & (entry_cnt - 1); entries[j].block != NULL;
+             j = (j + 1) & (entry_cnt - 1))
+          {
+            size_t h = entry_hash (entries[j].block);
+            if (((j - h) & (entry_cnt - 1)) >= ((j - i) & (entry_cnt - 1)))
+              {
+                entries[i] = entries[j];
+                i = j;
+              }
+          }
+        entries[i].block = NULL;
+        break;
+      }
+  intr_set_level (old_level);
+}
+
+/* Prints the call sites with allocations outstanding, most bytes
+   first, if the ledger is enabled. */
+void
+memstat_print_ledger (void) 
+{
+  unsigned char order[SITE_CNT];
+  size_t i, j;
+
+  if (entries == NULL)
+    return;
+
+  /* Sort by bytes outstanding.  Entries refer to sites by index,
+     so sort a list of indexes rather than the sites themselves. */
+  for (i = 0; i < site_cnt; i++)
+    {
+      for (j = i; j > 0 && (sites[i].cur_bytes
+                            > sites[order[j - 1]].cur_bytes); j--)
+        order[j] = order[j - 1];
+      order[j] = i;
+    }
+
+  printf ("Ledger: %zu allocations outstanding, %lld not tracked\n",
+          used_cnt, untracked_cnt);
+  for (i = 0; i < site_cnt && sites[order[i]].cur_cnt > 0; i++)
+    {
+      const struct site *s = &sites[order[i]];
+      printf ("  %p: %zu allocations, %zu bytes outstanding, %lld in all\n",
+              s->caller, s->cur_cnt, s->cur_bytes, s->alloc_cnt);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Usage counters for one allocator, pool, or size class. */
+struct memstat
+  {
+    long long cur;              /* Units in use now. */
+    long long peak;             /* Most units ever in use at once. */
+    long long alloc_cnt;        /* Successful allocations. */
+    long long fail_cnt;         /* Failed allocations. */
+  };
+
+/* If true, record every allocation by call site and list those
+   still outstanding at shutdown.  Controlled by kernel
+   command-line option "-ml". */
+extern bool memstat_ledger;
+
+void memstat_init (void);
+void memstat_alloc (struct memstat *, size_t units);
+void memstat_free (struct memstat *, size_t units);
+void memstat_fail (struct memstat *);
+void memstat_add (struct memstat *, long long alloc_cnt, long long free_cnt);
+void memstat_print (const char *what, const char *unit,
+                    const struct memstat *);
+
+void memstat_track (const void *, size_t bytes, const void *caller);
+void memstat_untrack (const void *);
+void memstat_print_ledger (void);
+
+#endif /* threads/memstat.h */
@@ -2,14 +2,17 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/memstat.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,14 +27,62 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages are kept
+   as blocks of 2**ORDER pages whose index within the pool is a
+   multiple of their size, one free list per order, so a single
+   page usually comes straight off the order-0 list and a bigger
+   request splits the smallest block big enough, in at most
+   MAX_ORDER steps.  A freed block merges with its "buddy", the
+   block of the same order it was split from, whenever the buddy
+   is free too.  A request for a number of pages that is not a
+   power of two takes the next power up and frees the pages past
+   the end again.
+
+   The idle thread zeroes free pages while there is nothing else
+   to do and keeps a short list of them in each pool, so that a
+   PAL_ZERO request for a page, such as for a new thread, page
+   table, or zero-filled user page, usually gets one without a
+   memset().  The zeroed pages are free but off the buddy lists;
+   they go back on if a request can't be met without them.
+
+   palloc_free_page() is called from schedule_tail(), which must
+   not sleep, so the free lists are protected by disabling
+   interrupts rather than by a lock.  Every operation on them is
+   short. */
+
+/* Largest block order.  A pool can't hold a bigger block than
+   2**MAX_ORDER pages, i.e. 4 GB. */
+#define MAX_ORDER 20
+
+/* Most zeroed pages a pool keeps, as a limit and as a fraction
+   of the pool, so that they don't split up too many blocks. */
+#define ZEROED_MAX 64
+#define ZEROED_FRACTION 16
+
+/* Per-page buddy bookkeeping. */
+struct block
+  {
+    struct list_elem elem;              /* Element in pool's free list. */
+    int8_t order;                       /* Order if first page of a free
+                                           block, otherwise -1. */
+  };
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+    struct block *blocks;               /* One per page. */
+    struct bitmap *used_map;            /* Pages off the free lists,
+                                           for checking. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages. */
+    size_t free_cnt;                    /* Number of free pages. */
+    struct list zeroed;                 /* Free pages filled with zeros. */
+    size_t zeroed_cnt;                  /* Number of pages in ZEROED. */
+    size_t zeroed_max;                  /* Most pages ZEROED may hold. */
+    struct memstat stats;               /* Pages handed out. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,7 +93,15 @@ size_t user_page_limit = SIZE_MAX;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
+static size_t pool_hdr_pages (size_t page_cnt);
+static size_t large_page_shift (const uint8_t *base, size_t page_cnt);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t pool_page_idx (const struct pool *, void *page);
+static struct pool *page_pool (void *page);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static void free_pages (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t take_zeroed (struct pool *);
+static void release_zeroed (struct pool *);
 
 /* Initializes the page allocator. */
 void
@@ -62,6 +121,26 @@ palloc_init (void)
     user_pages = user_page_limit;
   kernel_pages = free_pages - user_pages;
 
+  /* With -lp, a block of PTPAGES user pages can be mapped as a
+     single 4 MB page if it starts on a 4 MB boundary.  Blocks are
+     aligned to their size within their pool, so start the user
+     pool's pages on such a boundary, giving the pages before it to
+     the kernel pool, as long as the user pool still has room for a
+     large page.  A smaller header may let the pool start a page
+     earlier after each move, hence the loop. */
+  if (large_pages)
+    {
+      size_t shift;
+
+      while ((shift = large_page_shift (free_start + kernel_pages * PGSIZE,
+                                        user_pages)) != 0
+             && shift + PTPAGES + pool_hdr_pages (user_pages) <= user_pages)
+        {
+          kernel_pages += shift;
+          user_pages -= shift;
+        }
+    }
+
   /* Give half of memory to kernel, half to user. */
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
@@ -78,15 +157,44 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level;
+  bool zeroed = false;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  old_level = intr_disable ();
+  if (page_cnt == 1 && (flags & PAL_ZERO) && pool->zeroed_cnt > 0)
+    {
+      page_idx = take_zeroed (pool);
+      zeroed = true;
+    }
+  else
+    {
+      page_idx = alloc_pages (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+        {
+          /* The only free pages left, or the ones that would make
+             up a long enough run, are zeroed ones. */
+          if (page_cnt == 1)
+            {
+              page_idx = take_zeroed (pool);
+              zeroed = true;
+            }
+          else
+            {
+              release_zeroed (pool);
+              page_idx = alloc_pages (pool, page_cnt);
+            }
+        }
+    }
+  if (page_idx != BITMAP_ERROR)
+    memstat_alloc (&pool->stats, page_cnt);
+  else
+    memstat_fail (&pool->stats);
+  intr_set_level (old_level);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -95,7 +203,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -125,27 +233,48 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
-  size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  pool = page_pool (pages);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  old_level = intr_disable ();
+  free_pages (pool, pool_page_idx (pool, pages), page_cnt);
+  memstat_free (&pool->stats, page_cnt);
+  intr_set_level (old_level);
+}
+
+/* Frees the CNT single pages in PAGES, which need not be
+   contiguous, with interrupts disabled only once. */
+void
+palloc_free_pages (void *const pages[], size_t cnt) 
+{
+  enum intr_level old_level;
+  size_t i;
+
+#ifndef NDEBUG
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (pg_ofs (pages[i]) == 0);
+      memset (pages[i], 0xcc, PGSIZE);
+    }
+#endif
+
+  old_level = intr_disable ();
+  for (i = 0; i < cnt; i++)
+    {
+      struct pool *pool = page_pool (pages[i]);
+      free_pages (pool, pool_page_idx (pool, pages[i]), 1);
+      memstat_free (&pool->stats, 1);
+    }
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -155,25 +284,313 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Takes a free page that isn't known to be zeros off the user
+   pool, or else the kernel pool, fills it with zeros, and adds it
+   to the pool's zeroed pages, if that pool has fewer than it
+   keeps.  Returns true if it zeroed a page, false if there was
+   nothing to do.
+
+   Called by the idle thread with interrupts on.  The page belongs
+   to neither the free lists nor the zeroed ones while it is
+   zeroed, so nothing else can take it meanwhile. */
+bool
+palloc_zero_free_page (void) 
+{
+  struct pool *pools[] = {&user_pool, &kernel_pool};
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      struct pool *pool = pools[i];
+      enum intr_level old_level;
+      size_t page_idx = BITMAP_ERROR;
+
+      old_level = intr_disable ();
+      if (pool->zeroed_cnt < pool->zeroed_max
+          && pool->free_cnt > pool->zeroed_cnt)
+        page_idx = alloc_pages (pool, 1);
+      intr_set_level (old_level);
+      if (page_idx == BITMAP_ERROR)
+        continue;
+
+      memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      list_push_back (&pool->zeroed, &pool->blocks[page_idx].elem);
+      pool->zeroed_cnt++;
+      pool->free_cnt++;
+      intr_set_level (old_level);
+      return true;
+    }
+  return false;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) 
+{
+  memstat_print ("Kernel pool", "pages", &kernel_pool.stats);
+  memstat_print ("User pool", "pages", &user_pool.stats);
+}
+
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool.  The count is
+   only a snapshot: other threads may allocate or free pages as
+   soon as it has been read. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) 
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->free_cnt;
+}
+
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void) 
+{
+  return user_pool.page_cnt;
+}
+
+/* Returns the index of PAGE, which must have been allocated from
+   the user pool, within the user pool.  Indexes run from 0 up to
+   palloc_user_page_cnt(). */
+size_t
+palloc_user_page_idx (const void *page) 
+{
+  ASSERT (pg_ofs (page) == 0);
+  ASSERT (page_from_pool (&user_pool, (void *) page));
+  return pool_page_idx (&user_pool, (void *) page);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
+  /* We'll put the pool's used_map and block array at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t hdr_pages = pool_hdr_pages (page_cnt);
+  size_t i;
+
+  if (hdr_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  page_cnt -= hdr_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  /* Initialize the pool with every page allocated, then free
+     them all, which builds the free lists. */
+  for (i = 0; i <= MAX_ORDER; i++)
+    list_init (&p->free_lists[i]);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->blocks = (struct block *) ((uint8_t *) base + bm_size);
+  for (i = 0; i < page_cnt; i++)
+    p->blocks[i].order = -1;
+  bitmap_set_all (p->used_map, true);
+  p->base = (uint8_t *) base + hdr_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  free_pages (p, 0, page_cnt);
+
+  list_init (&p->zeroed);
+  p->zeroed_cnt = 0;
+  p->zeroed_max = page_cnt / ZEROED_FRACTION;
+  if (p->zeroed_max > ZEROED_MAX)
+    p->zeroed_max = ZEROED_MAX;
+}
+
+/* Returns the number of pages at the base of a pool of PAGE_CNT
+   pages taken by its used_map and block array. */
+static size_t
+pool_hdr_pages (size_t page_cnt) 
+{
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t blocks_size = page_cnt * sizeof (struct block);
+
+  return DIV_ROUND_UP (bm_size + blocks_size, PGSIZE);
+}
+
+/* Returns how many pages later a pool of PAGE_CNT pages at BASE
+   would have to start for its first page, after its header, to
+   be aligned on a 4 MB boundary. */
+static size_t
+large_page_shift (const uint8_t *base, size_t page_cnt) 
+{
+  uintptr_t first = vtop (base) + pool_hdr_pages (page_cnt) * PGSIZE;
+
+  return (PTSPAN - first % PTSPAN) % PTSPAN / PGSIZE;
+}
+
+/* Returns the order of the smallest block that holds PAGE_CNT
+   pages, or -1 if no block is that big. */
+static int
+cnt_order (size_t page_cnt) 
+{
+  int order;
+
+  for (order = 0; order <= MAX_ORDER; order++)
+    if ((size_t) 1 << order >= page_cnt)
+      return order;
+  return -1;
+}
+
+/* Takes the first free block of the given ORDER off POOL's free
+   lists, splitting a bigger block if none is free, and returns
+   the index of its first page, or BITMAP_ERROR if no block is big
+   enough.  Interrupts must be off. */
+static size_t
+alloc_block (struct pool *pool, int order) 
+{
+  struct block *b;
+  size_t page_idx;
+  int o;
+
+  for (o = order; o <= MAX_ORDER; o++)
+    if (!list_empty (&pool->free_lists[o]))
+      break;
+  if (o > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  b = list_entry (list_pop_front (&pool->free_lists[o]), struct block, elem);
+  b->order = -1;
+  page_idx = b - pool->blocks;
+
+  /* Give back the upper half of each split. */
+  while (o > order)
+    {
+      o--;
+      b = &pool->blocks[page_idx + ((size_t) 1 << o)];
+      b->order = o;
+      list_push_front (&pool->free_lists[o], &b->elem);
+    }
+  return page_idx;
+}
+
+/* Returns the block of ORDER starting at PAGE_IDX to POOL's free
+   lists, merging it with its buddy for as long as the buddy is
+   free.  Interrupts must be off. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) 
+{
+  while (order < MAX_ORDER)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      struct block *buddy = &pool->blocks[buddy_idx];
+
+      if (buddy_idx + ((size_t) 1 << order) > pool->page_cnt
+          || buddy->order != order)
+        break;
+      list_remove (&buddy->elem);
+      buddy->order = -1;
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  pool->blocks[page_idx].order = order;
+  list_push_front (&pool->free_lists[order], &pool->blocks[page_idx].elem);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no run that long is free.
+   Interrupts must be off. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt) 
+{
+  int order = cnt_order (page_cnt);
+  size_t page_idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (order < 0)
+    return BITMAP_ERROR;
+  page_idx = alloc_block (pool, order);
+  if (page_idx == BITMAP_ERROR)
+    return BITMAP_ERROR;
+
+#ifndef NDEBUG
+  ASSERT (bitmap_none (pool->used_map, page_idx, (size_t) 1 << order));
+  bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << order, true);
+#endif
+  pool->free_cnt -= (size_t) 1 << order;
+
+  /* Return the pages past the end of the request. */
+  if (((size_t) 1 << order) > page_cnt)
+    free_pages (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages of POOL starting at PAGE_IDX, which
+   need not be a block, as the largest blocks that fit.
+   Interrupts must be off. */
+static void
+free_pages (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+
+#ifndef NDEBUG
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#endif
+  pool->free_cnt += page_cnt;
+
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes a page off POOL's zeroed pages, which must not be empty,
+   and returns its index.  Interrupts must be off. */
+static size_t
+take_zeroed (struct pool *pool) 
+{
+  struct block *b;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  b = list_entry (list_pop_front (&pool->zeroed), struct block, elem);
+  pool->zeroed_cnt--;
+  pool->free_cnt--;
+  return b - pool->blocks;
+}
+
+/* Returns all of POOL's zeroed pages to its free lists.
+   Interrupts must be off. */
+static void
+release_zeroed (struct pool *pool) 
+{
+  while (pool->zeroed_cnt > 0)
+    free_pages (pool, take_zeroed (pool), 1);
+}
+
+/* Returns the pool PAGE was allocated from. */
+static struct pool *
+page_pool (void *page) 
+{
+  if (page_from_pool (&kernel_pool, page))
+    return &kernel_pool;
+  else if (page_from_pool (&user_pool, page))
+    return &user_pool;
+  else
+    NOT_REACHED ();
+}
+
+/* Returns the index of PAGE within POOL. */
+static size_t
+pool_page_idx (const struct pool *pool, void *page) 
+{
+  return pg_no (page) - pg_no (pool->base);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -183,7 +600,7 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
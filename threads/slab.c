@@ -0,0 +1,232 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* An object cache ("slab allocator").
+
+   A cache hands out objects of a single size, typically one
+   kernel structure.  Each page it gets from the page allocator,
+   called a "slab", holds a header followed by as many objects as
+   fit, packed end to end, so a structure a little bigger than a
+   power of 2 doesn't waste nearly half its block as it would
+   with malloc().
+
+   The header keeps the indexes of the slab's free objects on a
+   stack, so allocating or freeing an object takes constant time
+   and never writes to the object itself.  That lets a cache have
+   a constructor: it runs once on each object when its slab is
+   created, and objects must be freed in the state the
+   constructor left them in, so whatever it sets up (locks,
+   lists) is reused rather than rebuilt on every allocation.
+
+   Slabs with free objects are kept on the cache's list, partly
+   used ones in front, so that allocations fill them up before
+   touching an empty slab.  A slab that empties is given back to
+   the page allocator, except that one empty slab is kept so
+   that a cache whose use goes up and down by one object doesn't
+   get and free a page every time. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Object alignment. */
+#define SLAB_ALIGN sizeof (void *)
+
+/* Slab header, at the start of its page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's slabs list. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Stack of free object indexes. */
+  };
+
+/* All caches, most recently initialized first. */
+static struct slab_cache *caches;
+
+static struct slab *obj_to_slab (void *);
+static void *slab_obj (struct slab_cache *, struct slab *, size_t idx);
+
+/* Initializes cache C to hand out objects of SIZE bytes, naming
+   it NAME for debugging purposes.  If CTOR is nonnull, it is
+   called on each object before it is first allocated.  No memory
+   is allocated until the first object is. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 slab_ctor_func *ctor) 
+{
+  size_t cnt;
+
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, SLAB_ALIGN);
+  c->ctor = ctor;
+
+  /* Fit as many objects as there is room for after the header and
+     its free stack. */
+  cnt = (PGSIZE - sizeof (struct slab)) / (c->obj_size + sizeof (uint16_t));
+  while (cnt > 0
+         && ROUND_UP (sizeof (struct slab) + cnt * sizeof (uint16_t),
+                      SLAB_ALIGN) + cnt * c->obj_size > PGSIZE)
+    cnt--;
+  if (cnt == 0)
+    PANIC ("%s objects (%zu bytes) are too big for a slab", name, size);
+  c->objs_per_slab = cnt;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab) + cnt * sizeof (uint16_t),
+                         SLAB_ALIGN);
+
+  list_init (&c->slabs);
+  c->empty_cnt = 0;
+  lock_init (&c->lock);
+  memset (&c->stats, 0, sizeof c->stats);
+  c->next = caches;
+  caches = c;
+}
+
+/* Obtains and returns a new object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c) 
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* If no slab has a free object, create a new slab. */
+  if (list_empty (&c->slabs))
+    {
+      size_t i;
+
+      s = palloc_get_page (0);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          memstat_fail (&c->stats);
+          return NULL;
+        }
+
+      s->magic = SLAB_MAGIC;
+      s->cache = c;
+      s->free_cnt = c->objs_per_slab;
+      for (i = 0; i < c->objs_per_slab; i++)
+        {
+          /* Hand out low indexes first. */
+          s->free[i] = c->objs_per_slab - 1 - i;
+          if (c->ctor != NULL)
+            c->ctor (slab_obj (c, s, i));
+        }
+      list_push_back (&c->slabs, &s->elem);
+      c->empty_cnt++;
+    }
+
+  /* Take an object from the first slab. */
+  s = list_entry (list_front (&c->slabs), struct slab, elem);
+  if (s->free_cnt == c->objs_per_slab)
+    c->empty_cnt--;
+  obj = slab_obj (c, s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    list_remove (&s->elem);
+
+  lock_release (&c->lock);
+
+  memstat_alloc (&c->stats, 1);
+  memstat_track (obj, c->obj_size, __builtin_return_address (0));
+  return obj;
+}
+
+/* Frees OBJ, which must have been allocated with slab_alloc(),
+   returning it to its cache. */
+void
+slab_free (void *obj) 
+{
+  struct slab *s;
+  struct slab_cache *c;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (obj);
+  c = s->cache;
+  memstat_free (&c->stats, 1);
+  memstat_untrack (obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it has to keep its constructed state. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = ((uint8_t *) obj - (uint8_t *) s - c->obj_ofs)
+                           / c->obj_size;
+
+  /* A slab that was full wasn't on the list. */
+  if (s->free_cnt == 1)
+    list_push_front (&c->slabs, &s->elem);
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      /* The slab is empty.  Keep it at the back of the list if it
+         is the only empty one, otherwise free it. */
+      list_remove (&s->elem);
+      if (c->empty_cnt == 0)
+        {
+          list_push_back (&c->slabs, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        palloc_free_page (s);
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache that has been used. */
+void
+slab_print_stats (void) 
+{
+  struct slab_cache *c;
+
+  for (c = caches; c != NULL; c = c->next)
+    if (c->stats.alloc_cnt > 0)
+      {
+        char what[32];
+        snprintf (what, sizeof what, "Cache %s", c->name);
+        memstat_print (what, "objects", &c->stats);
+      }
+}
+
+/* Returns the slab that object OBJ is inside. */
+static struct slab *
+obj_to_slab (void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid. */
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT (pg_ofs (obj) >= s->cache->obj_ofs);
+  ASSERT ((pg_ofs (obj) - s->cache->obj_ofs) % s->cache->obj_size == 0);
+
+  return s;
+}
+
+/* Returns the IDX'th object within slab S of cache C. */
+static void *
+slab_obj (struct slab_cache *c, struct slab *s, size_t idx) 
+{
+  ASSERT (idx < c->objs_per_slab);
+  return (uint8_t *) s + c->obj_ofs + idx * c->obj_size;
+}
@@ -0,0 +1,33 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/memstat.h"
+#include "threads/synch.h"
+
+/* Prepares a freshly allocated object for use. */
+typedef void slab_ctor_func (void *obj);
+
+/* A cache of objects of one size. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for debugging purposes. */
+    size_t obj_size;            /* Bytes per object, rounded up. */
+    size_t objs_per_slab;       /* Objects in each slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    slab_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct list slabs;          /* Slabs with free objects. */
+    size_t empty_cnt;           /* Slabs in SLABS with no object in use. */
+    struct lock lock;           /* Lock. */
+    struct memstat stats;       /* Objects handed out. */
+    struct slab_cache *next;    /* Next cache, for statistics. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      slab_ctor_func *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -20,7 +20,7 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 #endif
-#include "threads/malloc.h"
+#include "threads/slab.h"
 
 
 /* Random value for struct thread's `magic' member.
@@ -37,6 +37,10 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Records of exited children that their parents haven't waited
+   for yet. */
+static struct slab_cache dead_thread_cache;
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -91,6 +95,8 @@ thread_init (void)
 
   lock_init (&tid_lock);
   list_init (&ready_list);
+  slab_cache_init (&dead_thread_cache, "dead_thread",
+                   sizeof (struct dead_thread), NULL);
   
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -232,10 +238,10 @@ thread_create_child (const char *name, struct file *file, int priority,
   cur->child_success = true;
 
   sema_init (&cur->child_sema, 0);
+  init_supplemental_pagetable (t);
 
   /* Add to run queue. */
   thread_unblock (t);
-  init_supplemental_pagetable (t);
 
   sema_down (&cur->child_sema);
   
@@ -337,7 +343,7 @@ thread_exit (void)
     if (child->status != THREAD_DEAD)
       child->parent = NULL;
     else
-        free (child); //our responsibility to free the dead_thread
+        slab_free (child); //our responsibility to free the dead_thread
   }
   lock_release (&t->children_lock);
   
@@ -346,7 +352,7 @@ thread_exit (void)
     lock_acquire (&t->parent->children_lock);
     //the parent could have died while acquiring the lock
     if (t->parent != NULL) {
-      struct dead_thread *dead = malloc (sizeof (struct dead_thread));
+      struct dead_thread *dead = slab_alloc (&dead_thread_cache);
 
       dead->tid = t->tid;
       dead->status = THREAD_DEAD;
@@ -357,14 +363,20 @@ thread_exit (void)
     lock_release (&t->parent->children_lock);
   }
 
-  destroy_supplemental_pagetable (t);
-
+  /* The frames have to go before the supplemental page table:
+     eviction records where it put a page in the table, and only
+     ft_destroy() waits for it. */
+  write_back_mapped_regions (t);
 #ifdef USERPROG
   process_exit ();
 #endif
+  destroy_supplemental_pagetable (t);
   
   //sema_up (&t->page_sema);
 
+  /* Give back the free blocks we were holding on to. */
+  malloc_drain ();
+
   /* Just set our status to dying and schedule another process.
      We will be destroyed during the call to schedule_tail(). */
   intr_disable ();
@@ -459,6 +471,16 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else wants to run, so zero free pages for later
+         PAL_ZERO requests, with interrupts on, until something
+         does or there are enough. */
+      intr_enable ();
+      while (list_empty (&ready_list) && palloc_zero_free_page ())
+        continue;
+      intr_disable ();
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -524,6 +546,8 @@ init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
   list_init (&t->children);
   lock_init (&t->children_lock);
+  list_init (&t->frames);
+  list_init (&t->shared_frames);
   t->exit_code = -1; //if we don't exit properly, then -1
   //sema_init (&t->page_sema, 1);
 }
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "vm/page.h"
 
@@ -120,14 +121,20 @@ struct thread
 #endif
     void * esp;                         /* The program's stack pointer when 
                                           it entered kernel mode. */
+    struct list vmas;                   /* File-backed regions, by address */
     struct hash sup_pagetable;          /* Supplemental page table */
     struct semaphore page_sema;         /* For supplemental page table */
+    struct list frames;                 /* Resident frames, under frame_lock */
+    struct list shared_frames;          /* Shared frame mappings, likewise */
 
     struct file *(files[NUM_FD]);       /* File descriptor table */
     
     bool in_syscall;                    /* Used to have different page_fault behavior
                                            during a syscall and without it */
 
+    /* Owned by threads/malloc.c. */
+    struct magazine magazines[MALLOC_CLASS_CNT]; /* Free blocks by size. */
+
     
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
@@ -10,16 +10,18 @@
 #include "threads/pte.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/zcache.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void swap_in (struct thread *, struct swap_page *, struct frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -120,12 +122,6 @@ kill (struct intr_frame *f)
 
 static const char *(strs[]) = {"false", "true"};
 static inline const char* b(bool val) {return strs[val];}
-static inline bool
-is_stack_access (void * address, void * esp) {
-  return (address < PHYS_BASE) 
-      && (address > STACK_BOTTOM) 
-      && (address + 32 >= esp);
-}
 
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
@@ -146,6 +142,7 @@ page_fault (struct intr_frame *f)
   bool user;         /* True: access by user, false: access by kernel. */
   void *fault_addr;  /* Fault address. */
   struct special_page_elem *gen_page;
+  struct vma *vma = NULL;
   void * esp;
   uint32_t fault_page;
   struct thread *cur = thread_current();
@@ -170,11 +167,23 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* A write to a present page may be to a page shared with a
+     parent or child since fork(). */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && ft_copy_on_write ((void *) fault_page))
+    return;
+
   esp = f->cs == SEL_KCSEG ? cur->esp : f->esp;
   gen_page = find_lazy_page (cur, fault_page);
+  if (gen_page == NULL)
+    vma = vma_find (cur, fault_page);
 
-  bool stack_access = is_stack_access(fault_addr, esp);
-  if (gen_page == NULL && !stack_access) {
+  bool stack_access = vma != NULL && vma->type == VMA_STACK;
+  if (stack_access && !vma_stack_access (vma, fault_addr, esp)) {
+    vma = NULL;
+    stack_access = false;
+  }
+  if (gen_page == NULL && vma == NULL) {
   
 	  struct list_elem *elem_test;
 	  struct frame *f_test;
@@ -192,8 +201,36 @@ page_fault (struct intr_frame *f)
     }
   }
   
-  /* Get a page of memory. */
-  struct frame *frame = ft_get_page (PAL_USER);   
+  /* A read-only executable page may already be resident for
+     another process running the same program, and a mapped file
+     page for another process mapping the same file. */
+  bool shared_page = false, mapped = false;
+  off_t offset = 0;
+  size_t zero_after = 0;
+  if (vma != NULL && !stack_access) {
+    offset = vma_page_offset (vma, fault_page);
+    zero_after = vma_page_bytes (vma, fault_page);
+    mapped = vma->type == VMA_FILE;
+    shared_page = mapped || (!vma->writable && zero_after > 0);
+  }
+  if (shared_page
+      && ft_map_shared (file_get_inode (vma->file), offset, zero_after,
+                        mapped, (void *) fault_page)) {
+    vma_fault_around (vma, fault_page);
+    return;
+  }
+
+  /* A big enough private region may be mapped 4 MB at a time. */
+  if (vma != NULL && !stack_access && !shared_page
+      && vma_map_large (vma, fault_page))
+    return;
+
+  /* Get a page of memory, already zeroed if that's all the page
+     will hold. */
+  enum palloc_flags flags = PAL_USER;
+  if (stack_access || (gen_page != NULL && gen_page->type == ZERO))
+    flags |= PAL_ZERO;
+  struct frame *frame = ft_get_page (flags);
   if (frame == NULL){
     printf ("Unable to get a page of memory to handle a page fault\n");
     exit (-1);
@@ -202,50 +239,45 @@ page_fault (struct intr_frame *f)
 
   bool writable = true;
   bool dirty = false;
-  if (gen_page != NULL) {
-    switch (gen_page->type) {
-    case FILE: //same as EXEC
-    case EXEC:
-      noop(); //why is this line needed?  Crazy C syntax
-      struct exec_page *exec_page = (struct exec_page*) gen_page;
-
-      lock_acquire (&filesys_lock);
-      /* Load this page. */
-      file_seek (exec_page->elf_file, exec_page->offset);
-      if (file_read (exec_page->elf_file, kpage, exec_page->zero_after) 
-          != (int) exec_page->zero_after) {
-        ft_free_page (kpage);
-        printf("Unable to read in exec file in page fault handler\n");
-        lock_release (&filesys_lock);
-        exit (-1);
-      }
+  if (vma != NULL && !stack_access) {
+    lock_acquire (&filesys_lock);
+    /* Load this page. */
+    if (file_read_at (vma->file, kpage, zero_after, offset)
+        != (int) zero_after) {
+      ft_free_page (kpage);
+      printf("Unable to read in exec file in page fault handler\n");
       lock_release (&filesys_lock);
-      memset ((uint8_t *)kpage + exec_page->zero_after, 0, PGSIZE - exec_page->zero_after);
-      if (exec_page->type == EXEC)
-        writable = exec_page->writable;
-      break;
+      exit (-1);
+    }
+    lock_release (&filesys_lock);
+    memset ((uint8_t *)kpage + zero_after, 0, PGSIZE - zero_after);
+    if (vma->type == VMA_EXEC)
+      writable = vma->writable;
+  }
+  else if (gen_page != NULL) {
+    switch (gen_page->type) {
     case SWAP:
       noop();
       struct swap_page *swap_page = (struct swap_page*) gen_page;
 
       dirty = swap_page->dirty;
-      swap_slot_read (kpage, swap_page->slot);
-
-      //delete swap_page in supplemental table.
-      sema_down (&cur->page_sema);
-      hash_delete (&cur->sup_pagetable, &swap_page->elem);
-      sema_up (&cur->page_sema);
-
-      if (swap_page->evicted_page != NULL)
-        add_lazy_page (thread_current (), swap_page->evicted_page);
-      free(swap_page);
+      swap_in (cur, swap_page, frame);
       break;
     case ZERO:
-      memset (kpage, 0, PGSIZE);
+      /* The frame came zeroed. */
       break;
     }
   }
 
+  /* Offer the page we just read to other processes. */
+  if (shared_page) {
+    if (!ft_share_frame (frame, file_get_inode (vma->file), offset,
+                         zero_after, mapped, (void *) fault_page))
+      exit (-1);
+    vma_fault_around (vma, fault_page);
+    return;
+  }
+
   lock_acquire (&frame_lock);
 
   /* Add the page to the process's address space. */
@@ -265,5 +297,142 @@ page_fault (struct intr_frame *f)
 
   lock_release (&frame_lock);
 
+  if (stack_access)
+    vma_grow_stack (vma, fault_page, esp);
+  else if (vma != NULL)
+    vma_fault_around (vma, fault_page);
 }
 
+/* Most pages brought in by one swap fault, counting the page that
+   faulted. */
+#define SWAP_READAROUND SWAP_CLUSTER_MAX
+
+/* Returns the swapped-out page of T that is DELTA pages away from
+   SWAP_PAGE, if its contents are in the swap slot DELTA slots
+   away from SWAP_PAGE's, otherwise a null pointer.
+   T's page_sema must be held. */
+static struct swap_page *
+swap_neighbour (struct thread *t, struct swap_page *swap_page, int delta)
+{
+  uint32_t upage = swap_page->virtual_page + delta * PGSIZE;
+  struct swap_page *n;
+
+  if (upage == 0 || !is_user_vaddr ((void *) upage))
+    return NULL;
+  n = (struct swap_page *) find_lazy_page_unsafe (t, upage);
+  if (n == NULL || n->type != SWAP || n->zentry != NULL
+      || n->slot != swap_page->slot + delta)
+    return NULL;
+  return n;
+}
+
+/* Reads SWAP_PAGE of CUR, which just faulted, from swap into
+   FRAME and drops it from CUR's supplemental page table.
+
+   Neighbouring pages whose contents sit in the adjacent swap slots
+   come in with the same disk transfer and are mapped right away,
+   with their accessed bits clear.  A sequential scan through
+   swapped-out memory then takes one fault per cluster instead of
+   one per page, and pages that turn out not to be wanted are the
+   first the clock evicts again.
+
+   Pages held in the zcache are just decompressed; there is no
+   disk transfer to share, so nothing is read around them. */
+static void
+swap_in (struct thread *cur, struct swap_page *swap_page, struct frame *frame)
+{
+  struct frame *spare[SWAP_READAROUND - 1];
+  struct swap_page *back[SWAP_READAROUND - 1];
+  struct swap_page *pages[SWAP_READAROUND];
+  struct frame *frames[SWAP_READAROUND];
+  void *kpages[SWAP_READAROUND];
+  struct swap_page *n;
+  size_t spare_cnt = 0, before = 0, after = 0, cnt, i;
+
+  if (swap_page->zentry != NULL)
+    {
+      sema_down (&cur->page_sema);
+      hash_delete (&cur->sup_pagetable, &swap_page->elem);
+      sema_up (&cur->page_sema);
+      zcache_load (frame->user_page, swap_page->zentry);
+      slab_free (swap_page);
+      return;
+    }
+
+  /* Frames for the neighbours have to be allocated before taking
+     page_sema, because eviction takes page_sema under frame_lock.
+     ft_try_get_page() only hands out frames that are already
+     free, so read-around never evicts anything. */
+  while (spare_cnt < SWAP_READAROUND - 1)
+    {
+      struct frame *f = ft_try_get_page (PAL_USER);
+      if (f == NULL)
+        break;
+      spare[spare_cnt++] = f;
+    }
+
+  /* Take the run of slots around SWAP_PAGE out of the supplemental
+     page table: following pages first, then preceding ones. */
+  sema_down (&cur->page_sema);
+  hash_delete (&cur->sup_pagetable, &swap_page->elem);
+  while (after < spare_cnt
+         && (n = swap_neighbour (cur, swap_page, after + 1)) != NULL)
+    {
+      hash_delete (&cur->sup_pagetable, &n->elem);
+      pages[1 + after++] = n;
+    }
+  while (before + after < spare_cnt
+         && (n = swap_neighbour (cur, swap_page, -(int) (before + 1))) != NULL)
+    {
+      hash_delete (&cur->sup_pagetable, &n->elem);
+      back[before++] = n;
+    }
+  sema_up (&cur->page_sema);
+
+  /* Lay the run out in slot order. */
+  cnt = before + 1 + after;
+  memmove (pages + before + 1, pages + 1, after * sizeof *pages);
+  pages[before] = swap_page;
+  for (i = 0; i < before; i++)
+    pages[i] = back[before - 1 - i];
+  for (i = 0; i < cnt; i++)
+    {
+      frames[i] = pages[i] == swap_page ? frame : spare[--spare_cnt];
+      kpages[i] = frames[i]->user_page;
+    }
+
+  swap_slots_read (kpages, swap_page->slot - before, cnt);
+
+  /* Give back the frames read-around didn't need. */
+  while (spare_cnt > 0)
+    ft_free_page (spare[--spare_cnt]->user_page);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct swap_page *sp = pages[i];
+
+      if (sp != swap_page)
+        {
+          /* The faulting page is mapped by our caller; map the
+             neighbours here.  If that fails, put the page back on
+             swap rather than lose its contents. */
+          lock_acquire (&frame_lock);
+          if (!install_page ((void *) sp->virtual_page, frames[i], true))
+            {
+              lock_release (&frame_lock);
+              sp->slot = swap_slot_write (kpages[i]);
+              ASSERT (sp->slot != SWAP_SLOT_ERROR);
+              add_lazy_page (cur, (struct special_page_elem *) sp);
+              ft_free_page (kpages[i]);
+              continue;
+            }
+          if (sp->dirty)
+            pagedir_set_dirty (cur->pagedir, (void *) sp->virtual_page, true);
+          frames[i]->virtual_address = (uint32_t *) sp->virtual_page;
+          frames[i]->loaded = true;
+          lock_release (&frame_lock);
+        }
+
+      slab_free (sp);
+    }
+}
@@ -11,15 +11,33 @@
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void load_pd (uint32_t *);
+static uint32_t **large_pts (uint32_t *pd);
+static void split_large_page (uint32_t *pd, uint32_t *pde);
+static uint32_t page_flags (uint32_t *pd, const void *vpage);
+
+/* User regions mapped with 4 MB pages (see vma_map_large()) still
+   have a page table each, kept in the page directory's second
+   page, whose entries map the same frames a page at a time.  The
+   frame table keeps pointers to those entries, and the large
+   page's accessed and dirty bits are copied to them when the
+   large page is split back into 4 kB pages, as it is as soon as
+   any one of its pages has to be unmapped, made read-only, or
+   otherwise changed on its own: to evict it, to share it
+   copy-on-write with a child, and so on.  Splitting allocates
+   nothing, so it can't fail.  Lookups that change nothing, and
+   clearing the accessed bit, work on the large page as a whole. */
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.  With -lp, a second page follows it to keep
+   track of the page tables of large pages. */
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_multiple (large_pages ? PAL_ZERO : 0,
+                                      large_pages ? 2 : 1);
   if (pd != NULL)
     memcpy (pd, base_page_dir, PGSIZE);
   return pd;
@@ -39,7 +57,8 @@ pagedir_destroy (uint32_t *pd)
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
     if (*pde & PTE_P) 
       {
-        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pt = (*pde & PTE_PS ? large_pts (pd)[pde - pd]
+                        : pde_get_pt (*pde));
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
@@ -47,7 +66,7 @@ pagedir_destroy (uint32_t *pd)
             palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
-  palloc_free_page (pd);
+  palloc_free_multiple (pd, large_pages ? 2 : 1);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -69,7 +88,9 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
-  if (*pde == 0) 
+  if (*pde & PTE_PS)
+    split_large_page (pd, pde);
+  else if (*pde == 0) 
     {
       if (create)
         {
@@ -130,9 +151,14 @@ pagedir_set_page (uint32_t *pd, void *upage, struct frame *frame, bool writable)
 void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
 {
+  uint32_t pde = pd[pd_no (uaddr)];
   uint32_t *pte;
 
   ASSERT (is_user_vaddr (uaddr));
+
+  if (pde & PTE_PS)
+    return ((uint8_t *) pde_get_large_page (pde)
+            + ((uintptr_t) uaddr & (PTSPAN - 1)));
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
@@ -191,6 +217,85 @@ install_page (void *upage, struct frame *frame, bool writable)
 }
 
 
+/* Returns true if PD maps no page in the PTSPAN bytes starting at
+   UPAGE, so that they could be mapped as a single large page. */
+bool
+pagedir_large_page_fits (uint32_t *pd, const void *upage) 
+{
+  uint32_t pde = pd[pd_no (upage)];
+  uint32_t *pt, *pte;
+
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  if (pde == 0)
+    return true;
+  if (pde & PTE_PS)
+    return false;
+  pt = pde_get_pt (pde);
+  for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+    if (*pte & PTE_P)
+      return false;
+  return true;
+}
+
+/* Maps the PTSPAN bytes starting at user virtual address UPAGE in
+   page directory PD as a single large page, made up of the
+   PTPAGES frames starting at FRAMES, which must be consecutive in
+   the frame table and so in memory, and start on a 4 MB boundary.
+   None of those pages may be mapped already; see
+   pagedir_large_page_fits().  If WRITABLE is true, the pages are
+   read/write; otherwise they are read-only.
+   Returns true if successful, false if memory allocation
+   failed. */
+bool
+pagedir_set_large_page (uint32_t *pd, void *upage, struct frame *frames,
+                        bool writable)
+{
+  uint32_t *pde = pd + pd_no (upage);
+  uint8_t *kpage = (uint8_t *) frames[0].user_page;
+  uint32_t *pt;
+  size_t i;
+
+  ASSERT (large_pages);
+  ASSERT (pagedir_large_page_fits (pd, upage));
+  ASSERT (((uintptr_t) kpage & (PTSPAN - 1)) == 0);
+
+  if (*pde == 0)
+    {
+      pt = palloc_get_page (0);
+      if (pt == NULL)
+        return false;
+    }
+  else
+    pt = pde_get_pt (*pde);
+
+  for (i = 0; i < PTPAGES; i++)
+    {
+      ASSERT ((void *) frames[i].user_page == kpage + i * PGSIZE);
+      pt[i] = pte_create_user (frames[i].user_page, writable);
+      frames[i].PTE = &pt[i];
+    }
+  large_pts (pd)[pde - pd] = pt;
+  *pde = pde_create_large_user (kpage, writable);
+  return true;
+}
+
+/* Returns the flags of the PTE for virtual page VPAGE in PD, or
+   of the large page VPAGE is part of, or 0 if PD has no PTE for
+   VPAGE. */
+static uint32_t
+page_flags (uint32_t *pd, const void *vpage) 
+{
+  uint32_t pde = pd[pd_no (vpage)];
+  uint32_t *pte;
+
+  if (pde & PTE_PS)
+    return pde & PTE_FLAGS;
+  pte = lookup_page (pd, vpage, false);
+  return pte != NULL ? *pte & PTE_FLAGS : 0;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -198,8 +303,7 @@ install_page (void *upage, struct frame *frame, bool writable)
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  return (page_flags (pd, vpage) & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
@@ -220,6 +324,22 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
@@ -227,16 +347,17 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return (page_flags (pd, vpage) & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  If VPAGE is part of a large page, sets the large
+   page's accessed bit instead, without splitting it. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pde = pd + pd_no (vpage);
+  uint32_t *pte = *pde & PTE_PS ? pde : lookup_page (pd, vpage, false);
   if (pte != NULL) 
     {
       if (accessed)
@@ -250,13 +371,25 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is there already. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = base_page_dir;
 
+  /* Loading CR3 flushes the TLB, so don't when PD is already
+     active, as it is when a process is switched back to after a
+     kernel thread. */
+  if (active_pd () != pd)
+    load_pd (pd);
+}
+
+/* Loads page directory PD into the CPU's page directory base
+   register, flushing all but global entries from the TLB. */
+static void
+load_pd (uint32_t *pd)
+{
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -291,8 +424,37 @@ invalidate_pagedir (uint32_t *pd)
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Reloading PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      load_pd (pd);
     } 
 }
+
+/* Returns the array, indexed like PD, of the page tables kept for
+   the large pages PD maps. */
+static uint32_t **
+large_pts (uint32_t *pd) 
+{
+  ASSERT (large_pages);
+  return (uint32_t **) (pd + PGSIZE / sizeof *pd);
+}
+
+/* Replaces PDE, an entry in PD that maps a large page, by one that
+   points to the page table kept for it, first copying the large
+   page's accessed and dirty bits to each of that table's entries,
+   which map the same frames. */
+static void
+split_large_page (uint32_t *pd, uint32_t *pde) 
+{
+  uint32_t *pt = large_pts (pd)[pde - pd];
+  uint32_t bits = *pde & (PTE_A | PTE_D);
+  uint32_t *pte;
+
+  ASSERT (pde < pd + pd_no (PHYS_BASE));
+
+  for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+    *pte |= bits;
+  *pde = pde_create (pt);
+  large_pts (pd)[pde - pd] = NULL;
+  invalidate_pagedir (pd);
+}
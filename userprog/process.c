@@ -21,11 +21,21 @@
 #include "threads/synch.h"
 #include "vm/frame.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 
 
 static thread_func execute_thread NO_RETURN;
+static thread_func fork_thread NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
+/* What a forking process hands to its child. */
+struct fork_args
+  {
+    struct intr_frame if_;      /* The parent's registers at fork(). */
+    struct thread *parent;      /* The forking process. */
+    struct list files;          /* Child's handles on mapped files. */
+  };
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -177,6 +187,110 @@ execute_thread (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Creates a child of the current process, which is in the system
+   call described by IF_, as a copy of it.  The child returns to
+   user mode from the same point with a return value of 0.  Its
+   address space is copied lazily, by sharing resident pages
+   copy-on-write and copying supplemental page table entries; it
+   gets its own handles on the parent's open and mapped files.
+   Returns the child's thread id, or TID_ERROR if it cannot be
+   created. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct thread *cur = thread_current ();
+  struct fork_args args;
+  struct file *file;
+  tid_t tid = TID_ERROR;
+
+  args.if_ = *if_;
+  args.parent = cur;
+  list_init (&args.files);
+
+  lock_acquire (&filesys_lock);
+  file = file_reopen (cur->file);
+  if (file != NULL)
+    file_deny_write (file);
+  lock_release (&filesys_lock);
+
+  if (file != NULL && fork_prepare_files (&args.files))
+    tid = thread_create_child (cur->name, file, PRI_DEFAULT, fork_thread,
+                               &args);
+  else if (file != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      file_close (file);
+      lock_release (&filesys_lock);
+    }
+
+  /* The child owns the handles now, unless it was never created. */
+  while (!list_empty (&args.files))
+    {
+      struct fork_file *ff = list_entry (list_pop_front (&args.files),
+                                         struct fork_file, elem);
+      if (tid == TID_ERROR)
+        {
+          lock_acquire (&filesys_lock);
+          file_close (ff->child_file);
+          lock_release (&filesys_lock);
+        }
+      free (ff);
+    }
+
+  return tid;
+}
+
+/* A thread function that copies its parent's address space and
+   open files, then returns to user mode where the parent made the
+   fork() system call. */
+static void
+fork_thread (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = args->parent;
+  struct intr_frame if_;
+  bool success;
+  int fd;
+
+  /* ARGS lives on the parent's stack, which is only ours until we
+     wake the parent. */
+  if_ = args->if_;
+  if_.eax = 0;
+
+  cur->pagedir = pagedir_create ();
+  success = cur->pagedir != NULL;
+  if (success)
+    {
+      process_activate ();
+      success = ft_fork (parent, &args->files);
+    }
+
+  lock_acquire (&filesys_lock);
+  for (fd = 2; success && fd < NUM_FD; fd++)
+    if (parent->files[fd] != NULL)
+      {
+        cur->files[fd] = file_reopen (parent->files[fd]);
+        if (cur->files[fd] == NULL)
+          success = false;
+        else
+          file_seek (cur->files[fd], file_tell (parent->files[fd]));
+      }
+  lock_release (&filesys_lock);
+
+  if (!success)
+    {
+      parent->child_success = false;
+      sema_up (&parent->child_sema);
+      exit (-1);
+    }
+  sema_up (&parent->child_sema);
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -212,7 +326,7 @@ process_wait (tid_t child_tid)
       list_remove (&d->child_elem);
       lock_release (&t->children_lock);
       if (d->status == THREAD_DEAD) 
-        free(d); // our responsibility to free a dead child
+        slab_free (d); // our responsibility to free a dead child
       return exit_code;
     }
     //otherwise, loop!
@@ -254,8 +368,12 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread has none of
+     its own and only touches kernel memory, which every page
+     directory maps the same way, so it keeps whichever is active
+     rather than flush the TLB twice to get back to a process. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -325,6 +443,8 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
+size_t stack_page_limit = MAX_STACK_SIZE;
+
 static bool setup_stack (void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
@@ -519,31 +639,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
   /* Failed if the range of pages mapped overlaps any existing set of mapping pages. 
      (Stack validation not implimented yet!) */
-  if (!validate_free_page (upage, read_bytes)) return false;
+  if (!validate_free_page (upage, read_bytes + zero_bytes)) return false;
 
-  while (read_bytes > 0 || zero_bytes > 0) 
-  {
-    /* Calculate how to fill this page.
-    We will read PAGE_READ_BYTES bytes from FILE
-    and zero the rest of the page. */
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-    struct special_page_elem *gen_page;
-    if (page_read_bytes == 0)
-      gen_page = (struct special_page_elem*)new_zero_page ((uint32_t)upage);
-    else
-      gen_page = (struct special_page_elem*) 
-                  new_exec_page ((uint32_t)upage, file, ofs, page_read_bytes, writable);
-    add_lazy_page (thread_current (), gen_page);
-    
-    /* Advance. */
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    ofs += PGSIZE;
-    upage += PGSIZE;
-  }
-  file_seek (file, ofs);
+  /* The whole segment is one region; its pages are read in as they
+     are faulted. */
+  struct thread *t = thread_current ();
+  struct vma *vma;
+  sema_down (&t->page_sema);
+  vma = vma_add (t, VMA_EXEC, (uint32_t) upage, read_bytes + zero_bytes,
+                 file, ofs, read_bytes, writable);
+  sema_up (&t->page_sema);
+  if (vma == NULL)
+    return false;
+
+  file_seek (file, ofs + read_bytes + zero_bytes);
   return true;
 }
 
@@ -552,6 +661,21 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
+  /* Reserve the region the stack may grow into.  Its lowest page is
+     left unmapped as a guard. */
+  struct thread *t = thread_current ();
+  uint32_t bottom = (uint32_t) STACK_BOTTOM;
+  struct vma *vma = NULL;
+  if (stack_page_limit >= 2
+      && !vma_overlaps (t, bottom, (uint32_t) PHYS_BASE)) {
+    sema_down (&t->page_sema);
+    vma = vma_add (t, VMA_STACK, bottom, (uint32_t) PHYS_BASE - bottom,
+                   NULL, 0, 0, true);
+    sema_up (&t->page_sema);
+  }
+  if (vma == NULL)
+    return false;
+
   struct frame *frame = ft_get_page (PAL_USER | PAL_ZERO); 
   if (frame == NULL)
     return false;
@@ -2,11 +2,18 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 
-#define MAX_STACK_SIZE 2000 //in pages
-#define STACK_BOTTOM PHYS_BASE - (PGSIZE * MAX_STACK_SIZE)
+#include <stddef.h>
+
+#define MAX_STACK_SIZE 2000 //in pages, by default
+#define STACK_BOTTOM (PHYS_BASE - (PGSIZE * stack_page_limit))
+
+/* Most pages a user stack may grow to, counting its guard page. */
+extern size_t stack_page_limit;
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -9,7 +9,7 @@
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
 
@@ -24,8 +24,14 @@ inline static struct file* get_file(int fd) {
 static int get_user (const uint8_t *uaddr);
 static bool put_user (uint8_t *udst, uint8_t byte);
 static void validate_read (const char *buffer, unsigned size);
-static void validate_write (char *from, char *user_to, unsigned size, bool malloc_buffer);
 static void validate_string (const char *string);
+static unsigned pin_user_buffer (const char *buffer, unsigned size, bool write);
+static void unpin_user_buffer (const char *buffer, unsigned size);
+
+/* Most pages of a user buffer pinned at a time by read and write;
+   larger transfers are done in pieces of this size, so that a big
+   buffer can't pin the whole user pool. */
+#define PIN_MAX_PAGES 16
 
 /* Terminates Pintos by calling power_off() (declared in "threads/init.h"). 
  This should be seldom used, because you lose some information about possible
@@ -58,6 +64,18 @@ static int exec (const char *cmd_line) {
   return tid;
 }
 
+/* Creates a new process, a copy of the current one, and returns
+  its pid in the parent and 0 in the child.  The child starts with
+  the same memory contents and open files, but its own copies of
+  them, and returns from the same fork call.  Returns -1 if the
+  child cannot be created. */
+static int sys_fork (struct intr_frame *f) {
+  tid_t tid = process_fork (f);
+  if (tid == TID_ERROR)
+    return -1;
+  return tid;
+}
+
 /* If process pid is still alive, waits until it dies. Then, returns
  the status that pid passed to exit, or -1 if pid was terminated by 
  the kernel (e.g. killed due to an exception). If pid does not refer 
@@ -118,9 +136,7 @@ static int open (const char *file){
  (due to a condition other than end of file). Fd 0 reads from the keyboard 
  using input_getc(). */
 static int read (int fd, void *buffer, unsigned size){
-  //TODO: validate buffer
-  int bytes_read;
-  char * localbuff;
+  int bytes_read = 0;
   if (buffer == NULL) return -1;
   if (fd == 1)
     return -1;
@@ -128,32 +144,66 @@ static int read (int fd, void *buffer, unsigned size){
     return -1; //TODO: STDIN
     
   struct file *file = get_file (fd);
-  localbuff = malloc (size);
-  lock_acquire (&filesys_lock);
-  bytes_read = file_read (file, localbuff, size);
-  lock_release (&filesys_lock);
-  validate_write (localbuff, buffer, bytes_read, true);
-  free (localbuff);
+  if (file == NULL)
+    return -1;
+
+  /* Read straight into the user's buffer, a pinned piece at a
+     time, so that none of it can be evicted under filesys_lock. */
+  while (size > 0) {
+    unsigned chunk = pin_user_buffer (buffer, size, true);
+    int n;
+
+    lock_acquire (&filesys_lock);
+    n = ft_file_read (file, buffer, chunk);
+    lock_release (&filesys_lock);
+    unpin_user_buffer (buffer, chunk);
+
+    bytes_read += n;
+    if ((unsigned) n < chunk)
+      break;
+    buffer = (char *) buffer + n;
+    size -= n;
+  }
   return bytes_read;
 }
 
 /* Writes size bytes from buffer to the open file fd. Returns the number of 
   bytes actually written, or -1 if the file could not be written. */
 static int write (int fd, const void *buffer, unsigned size){
-  validate_read(buffer, size);
-  struct file *file;
-  int result;
+  struct file *file = NULL;
+  int result = 0;
   
-  if (fd == 1){
-    putbuf (buffer, size);
-    return size;
+  if ((const char *) buffer + size >= (char *)PHYS_BASE)
+    exit(-1);
+  if (fd != 1){
+    file = get_file (fd);
+    if (file == NULL)
+      return -1;
+  }
+
+  /* Write straight from the user's buffer, a pinned piece at a
+     time, so that none of it can be evicted under filesys_lock. */
+  while (size > 0) {
+    unsigned chunk = pin_user_buffer (buffer, size, false);
+    int n;
+
+    if (fd == 1){
+      putbuf (buffer, chunk);
+      n = chunk;
+    }
+    else {
+      lock_acquire (&filesys_lock);
+      n = ft_file_write (file, buffer, chunk);
+      lock_release (&filesys_lock);
+    }
+    unpin_user_buffer (buffer, chunk);
+
+    result += n;
+    if ((unsigned) n < chunk)
+      break;
+    buffer = (const char *) buffer + n;
+    size -= n;
   }
-  file = get_file (fd);
-  if (file == NULL)
-    return -1;
-  lock_acquire (&filesys_lock);
-  result = file_write (file, buffer, size);
-  lock_release (&filesys_lock);
   return result;
 }
 
@@ -221,71 +271,119 @@ static int mmap (int fd, void *addr)
   /* Fail if the file is 0 empty, or the page is already taken */
   uint32_t read_bytes = file_length(file);
   if (read_bytes == 0 || !validate_free_page (addr, read_bytes)) {
+    file_close (file);
     lock_release (&filesys_lock);
     return -1;
   }
+  lock_release (&filesys_lock);
   
-  /* Otherwise, fulfill the file mapping. */
-  off_t ofs = 0;
+  /* Otherwise, fulfill the file mapping with a single region. */
   int mapping = (int)addr; // Use the virtual address as mapping id.
+  struct thread *cur = thread_current ();
+  struct vma *vma;
+
+  sema_down (&cur->page_sema);
+  vma = vma_add (cur, VMA_FILE, (uint32_t) addr, read_bytes, file, 0,
+                 read_bytes, true);
+  sema_up (&cur->page_sema);
+  if (vma == NULL) {
+    lock_acquire (&filesys_lock);
+    file_close (file);
+    lock_release (&filesys_lock);
+    return -1;
+  }
+  return mapping;
+}
 
-  
-  while (read_bytes > 0) 
-  {
-    /* Calculate how to fill this page.
-    We will read PAGE_READ_BYTES bytes from FILE
-    and zero the rest of the page. */
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    
-    add_lazy_page (thread_current(), (struct special_page_elem*)
-                      new_file_page(addr, file, ofs, page_read_bytes));
+/* Returns the region of the current process's mapping designated
+   by mapping, or a null pointer if there is no such mapping. */
+static struct vma *find_mapping (unsigned mapping)
+{
+  struct vma *vma;
 
-    /* Advance. */
-    read_bytes -= page_read_bytes;
-    ofs += PGSIZE;
-    addr += PGSIZE;
-  }
+  if ((mapping & 0x00000fff) != 0)
+    return NULL;
+  vma = vma_find (thread_current (), mapping);
+  if (vma == NULL || vma->type != VMA_FILE || vma->start != mapping)
+    return NULL;
+  return vma;
+}
 
-  lock_release (&filesys_lock);
-  return mapping;
+/* Unmaps every page of the region VMA of the current process,
+   freeing the frames no other process maps. */
+static void release_mapping (struct vma *vma)
+{
+  uint32_t upage;
+
+  for (upage = vma->start; upage < vma->end; upage += PGSIZE)
+    ft_release_page ((void *) upage);
 }
 
 /* Unmaps the mapping designated by int mapping. */
 static void munmap (unsigned mapping)
 {
-  if ((mapping & 0x00000fff) != 0)
-	  return;
+  struct thread *cur = thread_current ();
+  struct vma *vma = find_mapping (mapping);
 
-  struct file_page *file_page = (struct file_page*) find_lazy_page(thread_current (), mapping);
-  if (file_page == NULL || file_page->type != FILE)
-    return;
-  
-  struct file * file = file_page->source_file;
-  
-  lock_acquire (&filesys_lock);
-  uint32_t read_bytes = file_length(file);
-  lock_release (&filesys_lock);
-  
-  if (read_bytes == 0)
+  if (vma == NULL)
     return;
 
-  /* Get number of pages for this file. */
-  size_t num_of_pages = read_bytes / PGSIZE;
-  if (read_bytes % PGSIZE != 0)
-    num_of_pages++;
-  
-  unsigned i;
-  for(i = 0; i < num_of_pages; i++) {
-    sema_down(&thread_current()->page_sema);
-    expire_page ((struct special_page_elem *) file_page);
-    sema_up(&thread_current()->page_sema);
-    mapping += PGSIZE;
-    file_page = (struct file_page*) find_lazy_page(thread_current (), mapping);
-  }
+  /* Drop the region, write back only the pages that have changed,
+     and unmap them all.  The frames stay in the page cache while
+     other processes map them. */
+  sema_down (&cur->page_sema);
+  vma_remove (vma);
+  sema_up (&cur->page_sema);
+  vma_write_back (cur, vma);
+  release_mapping (vma);
 
   lock_acquire (&filesys_lock);
-  file_close (file);
+  file_close (vma->file);
   lock_release (&filesys_lock);
+  slab_free (vma);
+}
+
+/* Writes the pages of the mapping designated by mapping that have
+   changed back to the file, leaving them mapped.  Returns false if
+   there is no such mapping. */
+static bool msync (unsigned mapping)
+{
+  struct vma *vma = find_mapping (mapping);
+
+  if (vma == NULL)
+    return false;
+  vma_write_back (thread_current (), vma);
+  return true;
+}
+
+/* Tells the kernel how the mapping designated by mapping will be
+   used: MADV_SEQUENTIAL and MADV_RANDOM change how many pages
+   each fault brings in, MADV_NORMAL restores the default,
+   MADV_WILLNEED loads the mapping now, as far as free memory
+   allows, and MADV_DONTNEED writes it back and frees its frames.
+   Returns false if there is no such mapping or advice. */
+static bool madvise (unsigned mapping, int advice)
+{
+  struct vma *vma = find_mapping (mapping);
+
+  if (vma == NULL)
+    return false;
+  switch (advice) {
+  case VMA_NORMAL:
+  case VMA_SEQUENTIAL:
+  case VMA_RANDOM:
+    vma->advice = advice;
+    return true;
+  case VMA_WILLNEED:
+    vma_prefetch (vma);
+    return true;
+  case VMA_DONTNEED:
+    vma_write_back (thread_current (), vma);
+    release_mapping (vma);
+    return true;
+  default:
+    return false;
+  }
 }
 
 static void syscall_handler (struct intr_frame *);
@@ -329,6 +427,11 @@ syscall_handler (struct intr_frame *f)
     case SYS_MMAP    : validate_read ((char *)args, 2); return_val = mmap (args[0], (void *)args[1]); break; 
     case SYS_MUNMAP  : validate_read ((char *)args, 1); munmap (args[0]); break; 
 
+    /* Virtual memory extensions. */
+    case SYS_FORK    : return_val = sys_fork (f); break;
+    case SYS_MSYNC   : validate_read ((char *)args, 1); return_val = msync (args[0]); break;
+    case SYS_MADVISE : validate_read ((char *)args, 2); return_val = madvise (args[0], args[1]); break;
+
     default: exit(-1);
   }
   cur->in_syscall = false;
@@ -362,24 +465,50 @@ validate_read (const char *buffer, unsigned size)
       exit(-1);
 }
 
-/* Validate writing to user memory */
-static void 
-validate_write (char *from, char *user_to, unsigned size, bool malloc_buffer)
+/* Faults in and pins the pages under user buffer BUFFER, up to
+   SIZE bytes but no more than PIN_MAX_PAGES pages, and returns the
+   number of bytes pinned.  If WRITE is true the pages must be
+   writable.  Terminates the process if the buffer is invalid. */
+static unsigned
+pin_user_buffer (const char *buffer, unsigned size, bool write)
 {
-  unsigned count;
-  
-  if (user_to + size >= (char *)PHYS_BASE)
-  {
-    if (malloc_buffer) free(from);
-    exit(-1);   
-  } 
-  for (count = 0; count < size; count ++) {
-    if (!put_user (user_to+count, *(from+count)))
-    {
-      if (malloc_buffer) free(from);      
-      exit(-1);     
-    } 
+  const char *end, *upage;
+
+  if (size == 0)
+    return 0;
+  if (buffer + size >= (char *)PHYS_BASE)
+    exit(-1);
+
+  end = (char *) pg_round_down (buffer) + PIN_MAX_PAGES * PGSIZE;
+  if (end > buffer + size)
+    end = buffer + size;
+
+  for (upage = pg_round_down (buffer); upage < end; upage += PGSIZE) {
+    const char *touch = upage < buffer ? buffer : upage;
+
+    /* Touching the page faults it in, but it may be evicted again
+       before it is pinned, so repeat until the pin sticks. */
+    while (!ft_pin_page (upage, write)) {
+      int byte = get_user ((const uint8_t *) touch);
+      if (byte == -1 || (write && !put_user ((uint8_t *) touch, byte))) {
+        /* Let go of the pages already pinned before dying. */
+        if (upage > buffer)
+          unpin_user_buffer (buffer, upage - buffer);
+        exit(-1);
+      }
+    }
   }
+  return end - buffer;
+}
+
+/* Unpins the pages pinned by pin_user_buffer (BUFFER, SIZE). */
+static void
+unpin_user_buffer (const char *buffer, unsigned size)
+{
+  const char *upage;
+
+  for (upage = pg_round_down (buffer); upage < buffer + size; upage += PGSIZE)
+    ft_unpin_page (upage);
 }
 
 /* Reads a byte at user virtual address UADDR.
@@ -1,29 +1,153 @@
 #include <debug.h>
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/zcache.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
-#include "threads/interrupt.h"
+#include "threads/slab.h"
 #include "threads/pte.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "filesys/inode.h"
+#include <string.h>
 
-/* List of used frame. */
-//static struct list frame_list;
+/* Frame table, indexed by the page's index in the user pool, so
+   that the frame for a user page is found without searching. */
+static struct frame *frame_table;
 
-/* A frame structure pointer, named hand, for pointing a frame to evict. */
-static struct list_elem *hand;
+/* Number of entries in frame_table. */
+static size_t frame_table_size;
 
-static void *ft_replacement (void);
-static inline void check_and_set_hand (void);
+/* Shared frames, keyed by the executable or mapped file page they
+   hold.  The mapped file pages are the file's page cache: every
+   mapping of a page shares one frame, and read() and write() go
+   through it while it is resident. */
+static struct hash shared_cache;
+
+/* Mappings of shared frames. */
+static struct slab_cache mapping_cache;
+
+/* Index of the frame the clock hand points to.  Under the
+   two-handed clock this is the back hand, which evicts; the front
+   hand runs hand_spread frames ahead of it clearing accessed
+   bits. */
+static size_t hand;
+static size_t hand_spread;
+
+enum ft_policy ft_policy = FT_TWO_HANDED;
+size_t ft_hand_spread;
+
+/* Most unreferenced dirty frames the back hand passes over while
+   looking for a clean one, which costs no write to evict. */
+#define FT_DIRTY_SKIP 16
+
+/* Number of frames in use. */
+static size_t frame_cnt;
+
+/* Free frame watermarks.  Once fewer than low_water user frames
+   are free, ft_get_page() wakes the pageout thread, which evicts
+   clusters of frames until high_water frames are free again.
+   Both scale with the size of the user pool. */
+static size_t low_water, high_water;
+#define FT_MIN_LOW_WATER 4
+
+/* Pageout thread. */
+static struct semaphore pageout_sema;   /* Upped to wake it. */
+static bool pageout_awake;              /* True while it is reclaiming. */
+
+/* Evictions in progress, each with frame_lock dropped while it
+   writes its cluster out, and the condition they signal on
+   finishing, as ft_destroy() does on freeing a process's frames.
+   A fault that finds every candidate frame held by an eviction
+   waits on it rather than giving up. */
+static size_t evictions_in_flight;
+static struct condition frames_freed;
+
+/* Pages ft_destroy() hands back to the user pool at a time. */
+#define FT_FREE_BATCH 32
+
+static size_t ft_replacement (bool *busy);
+static thread_func pageout_thread;
+static bool is_zero_page (const void *);
+static struct frame *ft_add_frame (void *page);
+static void ft_remove_frame (struct frame *);
+static void drop_mappings (struct frame *);
+static struct frame_mapping *add_mapping (struct frame *, struct thread *,
+                                          void *upage, uint32_t *pte,
+                                          bool writable);
+static hash_hash_func shared_hash;
+static hash_less_func shared_less;
 
 /* Initialize the frame table. */
 void
 ft_init (void) 
 {
-  list_init (&frame_list);
+  size_t i;
+
   lock_init (&frame_lock);
+  slab_cache_init (&mapping_cache, "frame_mapping",
+                   sizeof (struct frame_mapping), NULL);
+
+  frame_table_size = palloc_user_page_cnt ();
+  frame_table = malloc (frame_table_size * sizeof *frame_table);
+  if (frame_table == NULL)
+    PANIC ("couldn't allocate frame table");
+  for (i = 0; i < frame_table_size; i++)
+  {
+    frame_table[i].t = NULL;
+    frame_table[i].shared = false;
+    frame_table[i].mapped = false;
+  }
+  hash_init (&shared_cache, shared_hash, shared_less, NULL);
   
-  hand = &frame_list.head;
+  hand = 0;
+  hand_spread = ft_hand_spread;
+  if (hand_spread == 0 || hand_spread >= frame_table_size)
+    hand_spread = frame_table_size / 4;
+
+  low_water = frame_table_size / 32;
+  if (low_water < FT_MIN_LOW_WATER)
+    low_water = FT_MIN_LOW_WATER;
+  high_water = 2 * low_water + SWAP_CLUSTER_MAX;
+  if (high_water > frame_table_size / 2)
+    high_water = frame_table_size / 2;
+  sema_init (&pageout_sema, 0);
+  cond_init (&frames_freed);
+}
+
+/* Start the pageout thread.  The scheduler must be running. */
+void
+ft_start_pageout (void)
+{
+  thread_create ("pageout", PRI_DEFAULT, pageout_thread, NULL);
+}
+
+/* Evicts frames in the background whenever ft_get_page() finds the
+   user pool running low, so that page faults usually find a free
+   frame waiting rather than paying for the eviction themselves.
+   frame_lock is dropped between clusters so that faults can take
+   the frames already freed. */
+static void
+pageout_thread (void *aux UNUSED)
+{
+  for (;;)
+  {
+    sema_down (&pageout_sema);
+
+    lock_acquire (&frame_lock);
+    while (palloc_free_cnt (PAL_USER) < high_water && frame_cnt > 0)
+    {
+      bool busy;
+
+      if (ft_replacement (&busy) == 0)
+        break;
+      lock_release (&frame_lock);
+      lock_acquire (&frame_lock);
+    }
+    pageout_awake = false;
+    lock_release (&frame_lock);
+  }
 }
 
 /* Get a user page from user pool, and add to our frame table if successful. */
@@ -34,95 +158,848 @@ ft_get_page (enum palloc_flags flags)
 
   lock_acquire (&frame_lock);
 
+  /* Have the pageout thread reclaim frames in batches, so that
+     their swap writes can be clustered, before the pool runs dry. */
+  if (palloc_free_cnt (PAL_USER) < low_water && !pageout_awake)
+  {
+    pageout_awake = true;
+    sema_up (&pageout_sema);
+  }
+
   void *page = palloc_get_page (flags);
   struct frame *f = NULL;
   
-  if (page == NULL)
+  /* The pageout thread hasn't kept up; evict a cluster here.  If
+     nothing could be evicted, wait for the evictions in progress,
+     which hold their victims and their owners' page_semas, to free
+     their frames.  Otherwise, if a candidate's owner was just busy
+     with its own page table, let it get on before trying again.
+     Give up only when every frame in use is pinned. */
+  while (page == NULL && frame_cnt > 0)
   {
-    page = ft_replacement();
-
-    if (page == NULL)
-      return NULL;
+    bool busy;
 
-    //f->t = thread_current();
-    //f->tid = thread_current()->tid;
+    if (ft_replacement (&busy) == 0)
+    {
+      if (evictions_in_flight > 0)
+        cond_wait (&frames_freed, &frame_lock);
+      else if (busy)
+      {
+        lock_release (&frame_lock);
+        thread_yield ();
+        lock_acquire (&frame_lock);
+      }
+      else
+        break;
+    }
+    page = palloc_get_page (flags);
   }
-  
-  f = malloc (sizeof (struct frame));
-  f->t = thread_current();
-  //f->tid = thread_current()->tid;
-  f->user_page = page;
-  f->loaded = false;
-  //*f->PTE &= ~(uint32_t) PTE_A; 
-  
-  list_push_back(&frame_list, &f->ft_elem);
+
+  if (page != NULL)
+    f = ft_add_frame (page);
   lock_release (&frame_lock);
   
   return f;
 }
 
+/* Get a user page from user pool without evicting anything, and add
+   it to our frame table.  Returns a null pointer if doing so would
+   take the pool below low_water free frames, so that speculative
+   users such as read-around never push other pages out. */
+struct frame *
+ft_try_get_page (enum palloc_flags flags)
+{
+  ASSERT (flags & PAL_USER);
+
+  if (palloc_free_cnt (PAL_USER) <= low_water)
+    return NULL;
+
+  lock_acquire (&frame_lock);
+  void *page = palloc_get_page (flags);
+  struct frame *f = NULL;
+
+  if (page != NULL)
+    f = ft_add_frame (page);
+  lock_release (&frame_lock);
+
+  return f;
+}
+
+/* Get a block of PTPAGES user pages, aligned on a 4 MB boundary so
+   that it can be mapped as a single large page, from the user pool
+   without evicting anything, and add them to our frame table.
+   Returns their frames, which are consecutive in the frame table,
+   or a null pointer if no such block is free or taking one would
+   leave the pool short of free frames. */
+struct frame *
+ft_try_get_large_page (void)
+{
+  struct frame *frames = NULL;
+  uint8_t *pages;
+  size_t i;
+
+  if (palloc_free_cnt (PAL_USER) <= high_water + PTPAGES)
+    return NULL;
+
+  lock_acquire (&frame_lock);
+  pages = palloc_get_multiple (PAL_USER, PTPAGES);
+  if (pages != NULL && vtop (pages) % PTSPAN != 0)
+  {
+    palloc_free_multiple (pages, PTPAGES);
+    pages = NULL;
+  }
+  if (pages != NULL)
+  {
+    for (i = 0; i < PTPAGES; i++)
+      ft_add_frame (pages + i * PGSIZE);
+    frames = &frame_table[palloc_user_page_idx (pages)];
+  }
+  lock_release (&frame_lock);
+
+  return frames;
+}
+
 /* Free an allocated page and also remove the page reference in the frame table. */
 void
 ft_free_page (void *page)
 { 
-  struct list_elem *elem;
-  struct frame *f;
+  struct frame *f = &frame_table[palloc_user_page_idx (page)];
   
   lock_acquire (&frame_lock);
+  if (f->t == thread_current())
+    ft_remove_frame (f);
+  lock_release (&frame_lock);
+  
+  palloc_free_page (page);
+}
 
-  //printf("ft_free_page!\n");
+/* Unmap the current thread's user page UPAGE and free its frame,
+   if it is resident and no other process maps it.  Used by munmap,
+   which has no further use for the page. */
+void
+ft_release_page (void *upage)
+{
+  struct thread *cur = thread_current ();
+  void *kpage;
 
-  lforeach(elem, &frame_list)
+  lock_acquire (&frame_lock);
+  kpage = pagedir_get_page (cur->pagedir, upage);
+  if (kpage != NULL)
   {
-    f = list_entry(elem, struct frame, ft_elem);
+    struct frame *f = &frame_table[palloc_user_page_idx (kpage)];
+    struct frame_mapping *m = NULL;
+    struct list_elem *e;
 
-    if (f->user_page == page && f->t == thread_current())
-    {
-      if (hand == &f->ft_elem)
+    if (f->shared)
+      lforeach (e, &f->mappings)
       {
-    	  hand = list_next(hand);
-    	  check_and_set_hand();
-      }	  
-      list_remove(elem);
-      free(f);
-      break;
+        m = list_entry (e, struct frame_mapping, frame_elem);
+        if (m->t == cur && m->upage == upage)
+          break;
+        m = NULL;
+      }
+
+    if (m != NULL)
+    {
+      pagedir_clear_page (cur->pagedir, upage);
+      list_remove (&m->frame_elem);
+      list_remove (&m->thread_elem);
+      slab_free (m);
+
+      /* If eviction, or a read or write of the file, has it
+         pinned, that frees the frame once done. */
+      if (list_empty (&f->mappings) && f->pin_cnt == 0)
+        ft_remove_frame (f);
+      else
+        kpage = NULL;
     }
+    /* Leave the frame alone if eviction has already claimed it. */
+    else if (f->t == cur && f->loaded && f->virtual_address == upage)
+    {
+      pagedir_clear_page (cur->pagedir, upage);
+      ft_remove_frame (f);
+    }
+    else
+      kpage = NULL;
   }
-  
   lock_release (&frame_lock);
-  
-  palloc_free_page (page);
+
+  if (kpage != NULL)
+    palloc_free_page (kpage);
+}
+
+/* Pin the frame holding the current thread's user page UPAGE, so
+   that it stays resident until ft_unpin_page().  Returns false,
+   pinning nothing, if UPAGE is not resident, or if WRITE is true
+   and UPAGE is read-only; the caller should fault the page in and
+   try again. */
+bool
+ft_pin_page (const void *upage, bool write)
+{
+  struct thread *cur = thread_current ();
+  bool pinned = false;
+  void *kpage;
+
+  lock_acquire (&frame_lock);
+  kpage = pagedir_get_page (cur->pagedir, upage);
+  if (kpage != NULL)
+  {
+    struct frame *f = &frame_table[palloc_user_page_idx (kpage)];
+
+    /* Other shared frames are mapped read-only everywhere.  A
+       write to one has to fault first, to get the thread its own
+       copy. */
+    if ((f->t == cur || f->shared) && f->loaded
+        && (!write || f->mapped || (!f->shared && (*f->PTE & PTE_W) != 0)))
+    {
+      f->pin_cnt++;
+      pinned = true;
+    }
+  }
+  lock_release (&frame_lock);
+
+  return pinned;
 }
 
-/* Destroy all the page references of thread t in frame table. */
+/* Clear the accessed bit of the current thread's user page UPAGE,
+   if it is resident, so that the clock takes it before pages in
+   use.  For a page the thread expects not to touch again. */
+void
+ft_deactivate_page (void *upage)
+{
+  struct thread *cur = thread_current ();
+
+  lock_acquire (&frame_lock);
+  if (pagedir_get_page (cur->pagedir, upage) != NULL)
+    pagedir_set_accessed (cur->pagedir, upage, false);
+  lock_release (&frame_lock);
+}
+
+/* Undo one ft_pin_page() of the current thread's user page UPAGE. */
+void
+ft_unpin_page (const void *upage)
+{
+  struct thread *cur = thread_current ();
+  void *kpage;
+
+  lock_acquire (&frame_lock);
+  kpage = pagedir_get_page (cur->pagedir, upage);
+  ASSERT (kpage != NULL);
+  struct frame *f = &frame_table[palloc_user_page_idx (kpage)];
+  ASSERT ((f->t == cur || f->shared) && f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Destroy all the page references of thread t in frame table,
+   unmapping and freeing its resident frames.  Only T's own frames
+   are visited, and they go back to the user pool in batches.
+   T's page_sema is held throughout, which waits out any eviction
+   of T's pages still writing them out with frame_lock dropped. */
 void
 ft_destroy (struct thread *t)
 {
+  void *pages[FT_FREE_BATCH];
+  size_t page_cnt = 0;
+
+  sema_down (&t->page_sema);
+  lock_acquire (&frame_lock);
+  while (!list_empty (&t->frames))
+  {
+    struct frame *f = list_entry (list_front (&t->frames),
+                                  struct frame, thread_elem);
+
+    /* T is exiting, so its page directory is about to be
+       destroyed; just drop the mapping so that
+       pagedir_destroy() doesn't free the page again. */
+    if (f->PTE != NULL)
+      *f->PTE &= ~PTE_P;
+    pages[page_cnt++] = f->user_page;
+    ft_remove_frame (f);
+
+    if (page_cnt == FT_FREE_BATCH)
+    {
+      palloc_free_pages (pages, page_cnt);
+      page_cnt = 0;
+    }
+  }
+  while (!list_empty (&t->shared_frames))
+  {
+    struct frame_mapping *m = list_entry (list_pop_front (&t->shared_frames),
+                                          struct frame_mapping, thread_elem);
+    struct frame *f = m->frame;
+
+    /* A shared frame goes when its last mapper does.  Keeping it
+       longer could hand a later exec stale text, once writes to
+       the executable are allowed again.  If eviction, or a read
+       or write of the file, has it pinned, that frees it.  T's
+       dirty mapped file pages have already been written back. */
+    *m->PTE &= ~PTE_P;
+    list_remove (&m->frame_elem);
+    slab_free (m);
+    if (list_empty (&f->mappings) && f->pin_cnt == 0)
+    {
+      pages[page_cnt++] = f->user_page;
+      ft_remove_frame (f);
+    }
+
+    if (page_cnt == FT_FREE_BATCH)
+    {
+      palloc_free_pages (pages, page_cnt);
+      page_cnt = 0;
+    }
+  }
+  palloc_free_pages (pages, page_cnt);
+  cond_broadcast (&frames_freed, &frame_lock);
+  lock_release (&frame_lock);
+  sema_up (&t->page_sema);
+}
+
+/* Fill in and return the frame table entry for PAGE, which was
+   just allocated from the user pool for the current thread. */
+static struct frame *
+ft_add_frame (void *page)
+{
+  struct frame *f = &frame_table[palloc_user_page_idx (page)];
+
+  ASSERT (f->t == NULL && !f->shared);
+  f->t = thread_current();
+  f->user_page = page;
+  f->PTE = NULL;
+  f->virtual_address = NULL;
+  f->loaded = false;
+  f->pin_cnt = 0;
+  list_push_back (&f->t->frames, &f->thread_elem);
+  frame_cnt++;
+
+  return f;
+}
+
+/* Mark F free in the frame table.  If F is shared, unmap it from
+   every process that maps it. */
+static void
+ft_remove_frame (struct frame *f)
+{
+  if (f->shared)
+  {
+    drop_mappings (f);
+    if (!f->cow)
+      hash_delete (&shared_cache, &f->cache_elem);
+    f->shared = false;
+    f->cow = false;
+    f->mapped = false;
+  }
+  else
+  {
+    ASSERT (f->t != NULL);
+    list_remove (&f->thread_elem);
+  }
+  f->t = NULL;
+  f->loaded = false;
+  frame_cnt--;
+}
+
+/* Unmap shared frame F from every process that maps it. */
+static void
+drop_mappings (struct frame *f)
+{
+  while (!list_empty (&f->mappings))
+  {
+    struct frame_mapping *m = list_entry (list_pop_front (&f->mappings),
+                                          struct frame_mapping, frame_elem);
+    pagedir_clear_page (m->t->pagedir, m->upage);
+    list_remove (&m->thread_elem);
+    slab_free (m);
+  }
+}
+
+/* Record that T maps shared frame F at UPAGE through page table
+   entry PTE, and return the new mapping, or a null pointer if
+   memory ran out.  frame_lock must be held. */
+static struct frame_mapping *
+add_mapping (struct frame *f, struct thread *t, void *upage, uint32_t *pte,
+             bool writable)
+{
+  struct frame_mapping *m = slab_alloc (&mapping_cache);
+
+  if (m == NULL)
+    return NULL;
+  m->frame = f;
+  m->t = t;
+  m->upage = upage;
+  m->PTE = pte;
+  m->writable = writable;
+  list_push_back (&f->mappings, &m->frame_elem);
+  list_push_back (&t->shared_frames, &m->thread_elem);
+  return m;
+}
+
+/* Map shared frame F at UPAGE in the current thread, writable if
+   it is a mapped file page, otherwise read-only.  frame_lock must
+   be held. */
+static bool
+map_shared (struct frame *f, void *upage)
+{
+  struct thread *cur = thread_current ();
+
+  if (!install_page (upage, f, f->mapped))
+    return false;
+  if (add_mapping (f, cur, upage, f->PTE, f->mapped) == NULL)
+  {
+    pagedir_clear_page (cur->pagedir, upage);
+    return false;
+  }
+  return true;
+}
+
+/* Returns the shared frame holding the first ZERO_AFTER bytes of
+   the page at OFFSET in the executable with inode INODE, or, if
+   MAPPED, the mapped file page at OFFSET in INODE, however many
+   bytes of it there are, or a null pointer.  frame_lock must be
+   held. */
+static struct frame *
+find_shared (struct inode *inode, off_t offset, size_t zero_after,
+             bool mapped)
+{
+  struct frame needle;
+  struct hash_elem *e;
+
+  needle.sector = inode_get_inumber (inode);
+  needle.offset = offset;
+  needle.zero_after = zero_after;
+  needle.mapped = mapped;
+  e = hash_find (&shared_cache, &needle.cache_elem);
+  return e != NULL ? hash_entry (e, struct frame, cache_elem) : NULL;
+}
+
+/* If another process running the same executable already has the
+   read-only page at OFFSET in INODE resident, or, if MAPPED, has
+   the page at OFFSET of the file with INODE mapped, map it at
+   UPAGE in the current thread and return true.  Otherwise return
+   false, and the caller should read the page in itself and offer
+   it with ft_share_frame(). */
+bool
+ft_map_shared (struct inode *inode, off_t offset, size_t zero_after,
+               bool mapped, void *upage)
+{
+  struct frame *f;
+  bool success = false;
+
+  lock_acquire (&frame_lock);
+  f = find_shared (inode, offset, zero_after, mapped);
+  if (f != NULL && f->loaded)
+    success = map_shared (f, upage);
+  lock_release (&frame_lock);
+
+  return success;
+}
+
+/* F, a frame of the current thread, has just been loaded with the
+   read-only page at OFFSET in INODE, or with the page at OFFSET of
+   a mapped file if MAPPED.  Make it a shared frame, map it at
+   UPAGE, and return true if successful.  If another process shared
+   the same page in the meantime, map that one instead and free F. */
+bool
+ft_share_frame (struct frame *f, struct inode *inode, off_t offset,
+                size_t zero_after, bool mapped, void *upage)
+{
+  struct frame *other;
+  void *kpage = f->user_page;
+  bool success;
+
+  lock_acquire (&frame_lock);
+  other = find_shared (inode, offset, zero_after, mapped);
+  if (other != NULL)
+  {
+    ft_remove_frame (f);
+    success = other->loaded && map_shared (other, upage);
+  }
+  else
+  {
+    kpage = NULL;
+    list_remove (&f->thread_elem);
+    f->t = NULL;
+    f->shared = true;
+    f->cow = false;
+    f->mapped = mapped;
+    f->inode = inode;
+    f->sector = inode_get_inumber (inode);
+    f->offset = offset;
+    f->zero_after = zero_after;
+    list_init (&f->mappings);
+    hash_insert (&shared_cache, &f->cache_elem);
+
+    success = map_shared (f, upage);
+    if (success)
+    {
+      f->virtual_address = upage;
+      f->loaded = true;
+    }
+    else
+    {
+      kpage = f->user_page;
+      ft_remove_frame (f);
+    }
+  }
+  lock_release (&frame_lock);
+
+  if (kpage != NULL)
+    palloc_free_page (kpage);
+  return success;
+}
+
+/* If T's mapped file page UPAGE is resident and T has written to
+   it, write its first BYTES bytes back to FILE at OFFSET and mark
+   it clean.  The frame is pinned while it is written, so T need
+   not hold its page_sema, and must not hold it, since this takes
+   frame_lock. */
+void
+ft_write_back (struct thread *t, void *upage, struct file *file,
+               off_t offset, size_t bytes)
+{
+  struct frame *f = NULL;
+  void *kpage;
+
+  lock_acquire (&frame_lock);
+  kpage = pagedir_get_page (t->pagedir, upage);
+  if (kpage != NULL && pagedir_is_dirty (t->pagedir, upage))
+  {
+    f = &frame_table[palloc_user_page_idx (kpage)];
+    f->pin_cnt++;
+    pagedir_set_dirty (t->pagedir, upage, false);
+  }
+  lock_release (&frame_lock);
+  if (f == NULL)
+    return;
+
+  lock_acquire (&filesys_lock);
+  file_write_at (file, kpage, bytes, offset);
+  lock_release (&filesys_lock);
+
+  lock_acquire (&frame_lock);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Undo a pin of F, a mapped file frame in the page cache, and
+   free it if the last process mapping it has let go of it
+   meanwhile. */
+static void
+unpin_cached (struct frame *f)
+{
+  void *kpage = NULL;
+
   lock_acquire (&frame_lock);
+  if (--f->pin_cnt == 0 && list_empty (&f->mappings))
+  {
+    kpage = f->user_page;
+    ft_remove_frame (f);
+  }
+  lock_release (&frame_lock);
+
+  if (kpage != NULL)
+    palloc_free_page (kpage);
+}
 
-  struct list_elem *elem = list_begin(&frame_list);
+/* Reads or writes, per WRITE, up to SIZE bytes of FILE at its
+   current position to or from BUFFER, a page of the file at a
+   time, and advances the position.  A page that some process has
+   mapped is read from its frame in the page cache, which may be
+   newer than the disk; a write goes to both the disk and the
+   frame.  The frame is only looked up and pinned under frame_lock;
+   the copy and the disk transfer happen without it.  Eviction
+   writes mapped pages back under filesys_lock, so it can't write
+   the frame back halfway through a copy.  filesys_lock must be
+   held and BUFFER, if a user buffer, pinned. */
+static off_t
+file_rw (struct file *file, void *buffer_, off_t size, bool write)
+{
+  struct inode *inode = file_get_inode (file);
+  uint8_t *buffer = buffer_;
+  off_t pos = file_tell (file);
+  off_t done = 0;
 
-  //printf("ft_destroy!\n");
-  while(elem != list_end(&frame_list)) 
+  while (done < size)
   {
-    struct frame *f = list_entry(elem, struct frame, ft_elem);
-    
-    if (f->t == t)
+    off_t page_ofs = pos & ~PGMASK;
+    size_t in_page = pos - page_ofs;
+    off_t chunk = size - done;
+    off_t n;
+    struct frame *f;
+
+    if (chunk > (off_t) (PGSIZE - in_page))
+      chunk = PGSIZE - in_page;
+
+    lock_acquire (&frame_lock);
+    f = find_shared (inode, page_ofs, 0, true);
+    if (f != NULL && f->loaded)
+      f->pin_cnt++;
+    else
+      f = NULL;
+    lock_release (&frame_lock);
+
+    if (write)
     {
-      if (hand == &f->ft_elem)
+      n = file_write_at (file, buffer + done, chunk, pos);
+      if (f != NULL)
       {
-    	  hand = list_next(hand);
-    	  check_and_set_hand();
-      }	  
-      list_remove(elem);
-      elem = list_next(elem);
-      free(f);
+        memcpy ((uint8_t *) f->user_page + in_page, buffer + done, n);
+        if (in_page + n > f->zero_after)
+          f->zero_after = in_page + n;
+      }
+    }
+    else if (f != NULL)
+    {
+      off_t length = inode_length (inode);
+      n = pos >= length ? 0 : (length - pos < chunk ? length - pos : chunk);
+      memcpy (buffer + done, (uint8_t *) f->user_page + in_page, n);
     }
     else
-      elem = list_next(elem);
+      n = file_read_at (file, buffer + done, chunk, pos);
+    if (f != NULL)
+      unpin_cached (f);
+
+    done += n;
+    pos += n;
+    if (n < chunk)
+      break;
+  }
+  file_seek (file, pos);
+  return done;
+}
+
+/* Like file_read(), but sees writes made to mapped pages of FILE
+   that have not been written back yet.  filesys_lock must be
+   held. */
+off_t
+ft_file_read (struct file *file, void *buffer, off_t size)
+{
+  return file_rw (file, buffer, size, false);
+}
+
+/* Like file_write(), but also updates the mapped pages of FILE.
+   filesys_lock must be held. */
+off_t
+ft_file_write (struct file *file, const void *buffer, off_t size)
+{
+  return file_rw (file, (void *) buffer, size, true);
+}
+
+/* Turn F, a resident page of its owner, into a frame shared
+   copy-on-write, mapped read-only by the owner alone for now, and
+   return the owner's mapping, or a null pointer if memory ran out.
+   frame_lock must be held. */
+static struct frame_mapping *
+make_cow (struct frame *f)
+{
+  struct thread *t = f->t;
+  struct frame_mapping *m;
+
+  list_init (&f->mappings);
+  m = add_mapping (f, t, f->virtual_address, f->PTE,
+                   (*f->PTE & PTE_W) != 0);
+  if (m == NULL)
+    return NULL;
+  list_remove (&f->thread_elem);
+  f->t = NULL;
+  f->shared = true;
+  f->cow = true;
+  pagedir_set_writable (t->pagedir, f->virtual_address, false);
+  return m;
+}
+
+/* Map the frame of SRC, which is shared copy-on-write, at the same
+   address in the current thread and on the same terms.
+   frame_lock must be held. */
+static bool
+map_cow (struct frame_mapping *src)
+{
+  struct thread *cur = thread_current ();
+  struct frame *f = src->frame;
+
+  if (!pagedir_set_page (cur->pagedir, src->upage, f, false))
+    return false;
+  if (add_mapping (f, cur, src->upage, f->PTE, src->writable) == NULL)
+  {
+    pagedir_clear_page (cur->pagedir, src->upage);
+    return false;
+  }
+  return true;
+}
+
+/* Give the current thread, a process just forked from PARENT, a
+   copy of PARENT's address space, and return true if successful.
+   Regions and supplemental page table entries are copied, with the
+   mapped files in them swapped for the child's handles listed in FILES.
+   Resident pages are not copied but shared copy-on-write: both
+   processes map them read-only until one writes to them.  Mapped
+   file pages are left out; the child maps the same frames from the
+   page cache when it faults on them. */
+bool
+ft_fork (struct thread *parent, struct list *files)
+{
+  struct list_elem *e, *next, *last;
+  struct frame_mapping *m;
+  bool success;
+
+  /* PARENT is blocked in fork(), so only eviction can hold its
+     page_sema, and not for long.  It is taken before frame_lock,
+     which eviction takes again while it holds page_sema. */
+  sema_down (&parent->page_sema);
+  lock_acquire (&frame_lock);
+
+  success = fork_supplemental_pagetable (thread_current (), parent, files);
+
+  /* Pages PARENT already shares copy-on-write get another mapper.
+     Stop at the last such page there now, since the loop below
+     adds more. */
+  if (success && !list_empty (&parent->shared_frames))
+  {
+    last = list_back (&parent->shared_frames);
+    for (e = list_begin (&parent->shared_frames); success; e = list_next (e))
+    {
+      m = list_entry (e, struct frame_mapping, thread_elem);
+      if (m->frame->cow)
+        success = map_cow (m);
+      if (e == last)
+        break;
+    }
+  }
+
+  for (e = list_begin (&parent->frames);
+       success && e != list_end (&parent->frames); e = next)
+  {
+    struct frame *f = list_entry (e, struct frame, thread_elem);
+
+    next = list_next (e);
+    if (!f->loaded)
+      continue;
+    m = make_cow (f);
+    success = m != NULL && map_cow (m);
+  }
+
+  lock_release (&frame_lock);
+  sema_up (&parent->page_sema);
+  return success;
+}
+
+/* Handle a write fault on the current thread's user page UPAGE,
+   which is mapped read-only.  If the page is writable but shared
+   copy-on-write, give the thread a copy of its own, or just the
+   frame if no other process shares it any more, and return true.
+   Otherwise the write is not allowed; return false. */
+bool
+ft_copy_on_write (void *upage)
+{
+  struct thread *cur = thread_current ();
+  struct frame_mapping *m = NULL;
+  struct frame *f, *copy;
+  struct list_elem *e;
+  void *kpage, *freed = NULL;
+  bool success;
+
+  lock_acquire (&frame_lock);
+  kpage = pagedir_get_page (cur->pagedir, upage);
+  if (kpage == NULL)
+  {
+    /* Evicted since the fault; it will fault back in. */
+    lock_release (&frame_lock);
+    return true;
+  }
+  f = &frame_table[palloc_user_page_idx (kpage)];
+  if (f->shared && f->cow)
+    lforeach (e, &f->mappings)
+    {
+      m = list_entry (e, struct frame_mapping, frame_elem);
+      if (m->t == cur)
+        break;
+      m = NULL;
+    }
+  if (m == NULL || !m->writable)
+  {
+    lock_release (&frame_lock);
+    return false;
+  }
+
+  if (list_size (&f->mappings) == 1)
+  {
+    /* The other mappers have exited or copied the page already. */
+    list_remove (&m->frame_elem);
+    list_remove (&m->thread_elem);
+    f->shared = f->cow = false;
+    f->t = cur;
+    f->PTE = m->PTE;
+    f->virtual_address = upage;
+    list_push_back (&cur->frames, &f->thread_elem);
+    slab_free (m);
+    pagedir_set_writable (cur->pagedir, upage, true);
+    pagedir_set_dirty (cur->pagedir, upage, true);
+    lock_release (&frame_lock);
+    return true;
+  }
+
+  /* Keep F in place while frame_lock is dropped to allocate the
+     copy.  Only this thread can remove its own mapping. */
+  f->pin_cnt++;
+  lock_release (&frame_lock);
+  copy = ft_get_page (PAL_USER);
+  if (copy != NULL)
+    memcpy (copy->user_page, f->user_page, PGSIZE);
+  lock_acquire (&frame_lock);
+  f->pin_cnt--;
+  if (copy == NULL)
+  {
+    lock_release (&frame_lock);
+    return false;
+  }
+
+  list_remove (&m->frame_elem);
+  list_remove (&m->thread_elem);
+  slab_free (m);
+  pagedir_clear_page (cur->pagedir, upage);
+  if (list_empty (&f->mappings))
+  {
+    freed = f->user_page;
+    ft_remove_frame (f);
+  }
+  success = install_page (upage, copy, true);
+  if (success)
+  {
+    pagedir_set_dirty (cur->pagedir, upage, true);
+    copy->virtual_address = upage;
+    copy->loaded = true;
   }
-  
   lock_release (&frame_lock);
+
+  if (freed != NULL)
+    palloc_free_page (freed);
+  if (!success)
+    ft_free_page (copy->user_page);
+  return success;
+}
+
+static unsigned
+shared_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, cache_elem);
+  return (hash_int (f->sector) ^ hash_int (f->offset)
+          ^ (f->mapped ? PGSIZE + 1 : f->zero_after));
+}
+
+static bool
+shared_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, cache_elem);
+  const struct frame *b = hash_entry (b_, struct frame, cache_elem);
+
+  if (a->mapped != b->mapped)
+    return a->mapped < b->mapped;
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return !a->mapped && a->zero_after < b->zero_after;
 }
 
 static bool
@@ -132,94 +1009,476 @@ is_frame(struct frame *f) {
          && (((int)f->PTE & 0xfffff000) != 0xccccc000);
 }
 
+/* Returns true if F holds a page that can be evicted right now. */
+static inline bool
+is_evictable (struct frame *f) {
+  return (f->t != NULL || f->shared) && f->loaded && f->pin_cnt == 0;
+}
+
+/* Returns true if F has been accessed through any of its mappings
+   since the accessed bits were last cleared.  A private frame may
+   be part of a large page, whose PTEs are not kept up to date, so
+   its owner's page directory is asked. */
+static bool
+frame_accessed (struct frame *f) {
+  struct list_elem *e;
+
+  if (!f->shared)
+    return pagedir_is_accessed (f->t->pagedir, f->virtual_address);
+  lforeach (e, &f->mappings)
+    if ((*list_entry (e, struct frame_mapping, frame_elem)->PTE & PTE_A) != 0)
+      return true;
+  return false;
+}
+
+/* Clear the accessed bits of all of F's mappings. */
+static void
+frame_clear_accessed (struct frame *f) {
+  struct list_elem *e;
+
+  if (!f->shared)
+  {
+    pagedir_set_accessed (f->t->pagedir, f->virtual_address, false);
+    return;
+  }
+  lforeach (e, &f->mappings)
+  {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, frame_elem);
+    pagedir_set_accessed (m->t->pagedir, m->upage, false);
+  }
+}
+
+/* Returns true if any process has written to F, a mapped file
+   frame, through its mapping since it was last written back. */
+static bool
+mapped_dirty (struct frame *f) {
+  struct list_elem *e;
+
+  lforeach (e, &f->mappings)
+    if ((*list_entry (e, struct frame_mapping, frame_elem)->PTE & PTE_D) != 0)
+      return true;
+  return false;
+}
+
+/* Returns true if F would have to be written somewhere to be
+   evicted.  Shared executable frames are read-only, so never
+   dirty; copy-on-write frames always go to swap. */
+static inline bool
+frame_dirty (struct frame *f) {
+  if (f->mapped)
+    return mapped_dirty (f);
+  if (!f->shared)
+    return pagedir_is_dirty (f->t->pagedir, f->virtual_address);
+  return f->cow;
+}
+
+/* Steps either clock may take before deciding that every frame is
+   pinned and giving up. */
+#define SCAN_LIMIT (2 * frame_table_size + hand_spread)
+
+/* Two-handed clock.  The front hand clears accessed bits and the
+   back hand, hand_spread frames behind it, takes the first frame
+   that hasn't been touched since.  A page therefore gets the time
+   the front hand takes to cover the spread to prove it is in use,
+   instead of a full revolution.
+
+   Clean frames, such as unmodified code and mapped file pages,
+   are preferred: evicting them needs no write.  The back hand
+   passes over up to FT_DIRTY_SKIP unreferenced dirty frames
+   looking for one before settling for the first dirty frame. */
+static struct frame *
+get_frame_two_handed (void) {
+  struct frame *dirty_victim = NULL;
+  size_t dirty_skipped = 0;
+  size_t steps;
+
+  for (steps = 0; steps < SCAN_LIMIT;
+       steps++, hand = (hand + 1) % frame_table_size)
+  {
+    struct frame *front =
+      &frame_table[(hand + hand_spread) % frame_table_size];
+    struct frame *f = &frame_table[hand];
+
+    if (is_evictable (front))
+      frame_clear_accessed (front);
+
+    /* Back round to the dirty frame we saw first: nothing clean
+       turned up in a whole revolution. */
+    if (f == dirty_victim)
+      return f;
+    if (!is_evictable (f) || frame_accessed (f))
+      continue;
+    if (!frame_dirty (f))
+      return f;
+    if (dirty_victim == NULL)
+      dirty_victim = f;
+    else if (++dirty_skipped >= FT_DIRTY_SKIP)
+      return dirty_victim;
+  }
+  return dirty_victim;
+}
+
+/* Returns a frame to evict, or a null pointer if every frame in
+   use is pinned.  frame_lock must be held; interrupts may be on,
+   since the accessed and dirty bits the clock reads are only ever
+   set behind its back, never cleared. */
 static struct frame *
 get_frame_for_replacement(void) {
-  check_and_set_hand();
-  struct frame *f = list_entry(hand, struct frame, ft_elem);
-  
+  size_t steps;
+
+  if (ft_policy == FT_TWO_HANDED && hand_spread > 0)
+    return get_frame_two_handed ();
+
   /* Second Chance replacement algorithm. */
   /* Choose the next page with Access bit not set. */
-  while ((f->loaded == true && (*f->PTE & PTE_A) != 0) || f->loaded == false)
-  {
-	if (f->loaded != false)
-	{	
-		//*f->PTE &= ~(uint32_t) PTE_A;
-		pagedir_set_accessed (f->t->pagedir, f->virtual_address, false);
-		//hand = list_remove(hand);
-		//list_push_back(&frame_list, &f->ft_elem);
-	}
-	
-	hand = list_next(hand);
-    
-    check_and_set_hand();
-    //printf("%08x\n", hand);
-    f = list_entry(hand, struct frame, ft_elem);
+  for (steps = 0; steps < SCAN_LIMIT;
+       steps++, hand = (hand + 1) % frame_table_size)
+  {
+    struct frame *f = &frame_table[hand];
+
+    if (!is_evictable (f))
+      continue;
+    if (!frame_accessed (f))
+      return f;
+    frame_clear_accessed (f);
   }
-  return f;
+  return NULL;
 }
 
-static void *
-ft_replacement (void)
+/* A frame chosen for eviction, and where its contents went. */
+struct victim
 {
-  ASSERT (!list_empty(&frame_list));
-  //lock_acquire (&frame_lock);
-  enum intr_level old_level = intr_disable ();
-  struct frame *f = get_frame_for_replacement ();
-  ASSERT(is_frame(f));
-  void * kpage = f->user_page;
-  bool dirty = (*f->PTE) & PTE_D;
-  void * user_page = f->virtual_address;
-  struct thread *evict_t = f->t;
-  ASSERT(is_frame(f));
-  struct special_page_elem *evicted_page = find_lazy_page(f->t, (uint32_t)f->virtual_address);
+  struct frame *frame;
+  bool dirty;                         /* Has to be saved somewhere. */
+  bool zero;                          /* Holds nothing but zeros. */
+  struct zcache_entry *zentry;        /* Its zcache entry, if any. */
+  swap_slot_t slot;                   /* Its swap slot, if any. */
+};
 
-  sema_down(&f->t->page_sema);
-  pagedir_clear_page(f->t->pagedir, f->virtual_address);
-  
-  intr_set_level (old_level);
-    
-  if (dirty) {
-    if (evicted_page != NULL && evicted_page->type == FILE){
-      struct file_page *file_page = (struct file_page*) evicted_page;
-      file_write_at (file_page->source_file, kpage, file_page->zero_after, file_page->offset);      
+/* Most threads whose page_semas one cluster may hold: the owners
+   of private victims and the mappers of copy-on-write ones. */
+#define FT_OWNER_MAX (4 * SWAP_CLUSTER_MAX)
+
+static bool hold_owner (struct thread *, struct thread **, size_t *);
+static bool hold_cow_mappers (struct frame *, struct thread **, size_t *);
+static void record_evicted (struct thread *, void *upage,
+                            const struct victim *);
+
+/* Evict a cluster of up to SWAP_CLUSTER_MAX frames, return them
+   to the user pool, and return how many were evicted.  *BUSY is
+   set to true if any frame was passed over because its owner, or
+   the file system, was busy.  Dirty mapped-file victims are
+   written back to their files.  Other dirty victims that hold
+   nothing but zeros become zero pages again; the rest are
+   compressed into the zcache, and those it won't take are written
+   to consecutive swap slots with a single disk transfer.  A frame
+   shared copy-on-write goes to the same place for every process
+   that maps it.
+
+   frame_lock must be held, and is held again on return.  The
+   victims are chosen, pinned and unmapped under it.  It is then
+   dropped while their contents are compressed and written out, so
+   that faults that need no eviction, and read() and write(), don't
+   wait behind the disk, and taken again to record where each page
+   went and free the frames.
+
+   Each process whose supplemental page table entry for a victim
+   changes has its page_sema held from choosing the victim to
+   recording it, so that it can't fault the page back in early, or
+   exit under us.  page_sema is only tried under frame_lock, never
+   waited for, since a thread holding its page_sema may be waiting
+   for frame_lock; busy owners' frames are left for later.
+   filesys_lock is likewise only tried under frame_lock, since
+   read() and write() take frame_lock under it; the write-backs
+   wait for it once frame_lock is dropped.
+
+   While frame_lock is dropped the eviction counts in
+   evictions_in_flight, and once it is done it wakes the faults
+   waiting on frames_freed. */
+static size_t
+ft_replacement (bool *busy)
+{
+  struct victim victims[SWAP_CLUSTER_MAX];
+  struct thread *owners[FT_OWNER_MAX];
+  struct frame *skipped[SWAP_CLUSTER_MAX];
+  void *swap_frames[SWAP_CLUSTER_MAX];
+  struct victim *swap_victims[SWAP_CLUSTER_MAX];
+  size_t victim_cnt = 0, owner_cnt = 0, swap_cnt = 0, skip_cnt = 0;
+  size_t evicted = 0;
+  bool have_mapped = false;
+  struct list_elem *e;
+  size_t i, j;
+
+  ASSERT (frame_cnt > 0);
+
+  /* Leave at least half of the frames alone, so that the clock can
+     always find a victim among them. */
+  size_t want = frame_cnt / 2;
+  if (want > SWAP_CLUSTER_MAX)
+    want = SWAP_CLUSTER_MAX;
+  if (want == 0)
+    want = 1;
+
+  while (victim_cnt < want && skip_cnt < SWAP_CLUSTER_MAX)
+  {
+    struct frame *f = get_frame_for_replacement ();
+    struct victim *v;
+    bool held = true;
+
+    if (f == NULL)
+      break;
+    ASSERT(is_frame(f));
+
+    /* Keep the clock from choosing F again for this cluster. */
+    f->pin_cnt++;
+
+    /* Hold the supplemental page table of every process whose
+       entry for the page will change: the owner of a private
+       frame, or each mapper of a copy-on-write one.  A shared
+       executable or mapped file page is still covered by each
+       mapper's region, so there is nothing to hold. */
+    if (!f->shared)
+      held = hold_owner (f->t, owners, &owner_cnt);
+    else if (f->cow)
+      held = hold_cow_mappers (f, owners, &owner_cnt);
+
+    /* A mapped file page is written back after its mappers, whose
+       open files keep the inode alive, have let go of it, so hold
+       the inode open until then. */
+    if (held && f->mapped)
+    {
+      held = lock_try_acquire (&filesys_lock);
+      if (held)
+      {
+        inode_reopen (f->inode);
+        lock_release (&filesys_lock);
+        have_mapped = true;
+      }
+    }
+    if (!held)
+    {
+      skipped[skip_cnt++] = f;
+      continue;
     }
-    else {
-      struct swap_slot *ss = swap_slot_write(kpage);
-      ASSERT(ss != NULL && !!"unable to obtain a swap slot");
-      
-      if (evicted_page != NULL)
-        hash_delete(&evict_t->sup_pagetable, &evicted_page->elem);
-      add_lazy_page_unsafe (evict_t, (struct special_page_elem*)
-                     new_swap_page (user_page, ss, dirty, evicted_page));
+
+    v = &victims[victim_cnt++];
+    v->frame = f;
+    v->zero = false;
+    v->zentry = NULL;
+    v->slot = SWAP_SLOT_ERROR;
+
+    /* Unmap the page everywhere before reading its dirty bits, so
+       that nobody can dirty it after we look. */
+    if (f->shared)
+    {
+      lforeach (e, &f->mappings)
+      {
+        struct frame_mapping *m = list_entry (e, struct frame_mapping,
+                                              frame_elem);
+        pagedir_clear_page (m->t->pagedir, m->upage);
+      }
+      v->dirty = frame_dirty (f);
+
+      /* Mappers of an executable or mapped file page find it in
+         the page cache if they fault on it before it goes, so
+         their mappings can go now.  A copy-on-write page's
+         mappers keep theirs until they get their new entries. */
+      if (!f->cow)
+        drop_mappings (f);
+    }
+    else
+    {
+      pagedir_clear_page (f->t->pagedir, f->virtual_address);
+      v->dirty = (*f->PTE & PTE_D) != 0;
     }
   }
 
-  if (hand == &f->ft_elem)
+  for (i = 0; i < skip_cnt; i++)
+    skipped[i]->pin_cnt--;
+  *busy = skip_cnt > 0;
+
+  /* Save the victims' contents without frame_lock.  They are
+     pinned and unmapped, and their owners can't fault them back
+     in, so nothing else changes them meanwhile, except write() to
+     a mapped page, which holds filesys_lock as the write-back
+     does. */
+  evictions_in_flight++;
+  lock_release (&frame_lock);
+
+  if (have_mapped)
   {
-	  hand = list_next(hand);
-	  check_and_set_hand();
-  }	  
+    lock_acquire (&filesys_lock);
+    for (i = 0; i < victim_cnt; i++)
+    {
+      struct frame *f = victims[i].frame;
 
-  list_remove(&f->ft_elem);
-  free(f);
-  
-  sema_up (&evict_t->page_sema);
-  
-//   lock_acquire (&frame_lock);
-  hand = list_next(hand);
-  check_and_set_hand();
+      if (!f->mapped)
+        continue;
+      if (victims[i].dirty)
+        inode_write_at (f->inode, f->user_page, f->zero_after, f->offset);
+      inode_close (f->inode);
+    }
+    lock_release (&filesys_lock);
+  }
+
+  for (i = 0; i < victim_cnt; i++)
+  {
+    struct victim *v = &victims[i];
+    void *kpage = v->frame->user_page;
+
+    if (!v->dirty || v->frame->mapped)
+      continue;
+    if (is_zero_page (kpage))
+      v->zero = true;
+    else if ((v->zentry = zcache_store (kpage)) == NULL)
+    {
+      swap_frames[swap_cnt] = kpage;
+      swap_victims[swap_cnt++] = v;
+    }
+  }
+
+  if (swap_cnt > 0)
+  {
+    /* Fall back to one slot at a time if the swap disk has no run
+       of free slots long enough for the whole cluster. */
+    swap_slot_t first = swap_slots_write (swap_frames, swap_cnt);
+    for (i = 0; i < swap_cnt; i++)
+    {
+      swap_slot_t slot = (first != SWAP_SLOT_ERROR ? first + i
+                          : swap_slot_write (swap_frames[i]));
+      ASSERT(slot != SWAP_SLOT_ERROR && !!"unable to obtain a swap slot");
+      swap_victims[i]->slot = slot;
+    }
+  }
+
+  lock_acquire (&frame_lock);
 
-  //lock_release (&frame_lock);
+  for (i = 0; i < victim_cnt; i++)
+  {
+    struct victim *v = &victims[i];
+    struct frame *f = v->frame;
+    void *kpage = f->user_page;
 
-  return kpage;
+    if (f->shared && !f->cow)
+    {
+      /* Mapped or pinned again while frame_lock was dropped: in
+         use after all, so it stays. */
+      if (!list_empty (&f->mappings) || f->pin_cnt > 1)
+      {
+        f->pin_cnt--;
+        continue;
+      }
+    }
+    else if (v->dirty && !f->shared)
+      record_evicted (f->t, f->virtual_address, v);
+    else if (v->dirty)
+    {
+      bool first = true;
+
+      lforeach (e, &f->mappings)
+      {
+        struct frame_mapping *m = list_entry (e, struct frame_mapping,
+                                              frame_elem);
+
+        /* Every mapper's entry shares the one copy. */
+        if (!first && v->zentry != NULL)
+          zcache_dup (v->zentry);
+        else if (!first && v->slot != SWAP_SLOT_ERROR)
+          swap_slot_dup (v->slot);
+        first = false;
+        record_evicted (m->t, m->upage, v);
+      }
+    }
+    ft_remove_frame (f);
+    palloc_free_page (kpage);
+    evicted++;
+  }
+
+  for (j = 0; j < owner_cnt; j++)
+    sema_up (&owners[j]->page_sema);
+  evictions_in_flight--;
+  cond_broadcast (&frames_freed, &frame_lock);
+
+  return evicted;
 }
 
-static inline void 
-check_and_set_hand (void)
+/* Take T's page_sema for the cluster being put together, unless
+   it is among the OWNER_CNT threads in OWNERS whose page_semas are
+   held already, and return true.  Return false if it is busy. */
+static bool
+hold_owner (struct thread *t, struct thread **owners, size_t *owner_cnt)
 {
-  if (hand == &frame_list.head)
-    hand = list_next(hand);
-  
-  if (hand == list_end(&frame_list))
-    hand = list_begin(&frame_list);
+  size_t j;
+
+  for (j = 0; j < *owner_cnt; j++)
+    if (owners[j] == t)
+      return true;
+  if (*owner_cnt == FT_OWNER_MAX || !sema_try_down (&t->page_sema))
+    return false;
+  owners[(*owner_cnt)++] = t;
+  return true;
+}
+
+/* Take the page_semas of all of the processes that map F, a frame
+   shared copy-on-write, as hold_owner() does, and return true.
+   If any of them is busy, give back those just taken and return
+   false. */
+static bool
+hold_cow_mappers (struct frame *f, struct thread **owners, size_t *owner_cnt)
+{
+  size_t held = *owner_cnt;
+  struct list_elem *e;
+
+  lforeach (e, &f->mappings)
+  {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping,
+                                          frame_elem);
+    if (!hold_owner (m->t, owners, owner_cnt))
+    {
+      while (*owner_cnt > held)
+        sema_up (&owners[--*owner_cnt]->page_sema);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Replace T's supplemental page table entry for UPAGE, if any,
+   with one saying where victim V's contents went.  A ZERO page's
+   own entry already says so; anything else, including a stack page
+   or a region's page with no entry, gets a new one.  T's page_sema
+   must be held. */
+static void
+record_evicted (struct thread *t, void *upage, const struct victim *v)
+{
+  struct special_page_elem *page =
+    find_lazy_page_unsafe (t, (uint32_t) upage);
+
+  if (v->zero && page != NULL && page->type == ZERO)
+    return;
+  if (page != NULL)
+  {
+    hash_delete (&t->sup_pagetable, &page->elem);
+    slab_free (page);
+  }
+  if (v->zero)
+    add_lazy_page_unsafe (t, (struct special_page_elem *)
+                          new_zero_page ((uint32_t) upage));
+  else
+    add_lazy_page_unsafe (t, (struct special_page_elem *)
+                          new_swap_page ((uint32_t) upage, v->slot,
+                                         v->zentry, true));
+}
+
+/* Returns true if every byte of PAGE is zero. */
+static bool
+is_zero_page (const void *page)
+{
+  const unsigned long *p = page;
+  const unsigned long *end = p + PGSIZE / sizeof *p;
+
+  for (; p < end; p++)
+    if (*p != 0)
+      return false;
+  return true;
 }
@@ -1,31 +1,96 @@
 #ifndef VM_FRAME_H_
 #define VM_FRAME_H_
 
-#include <list.h>
+#include <hash.h>
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "filesys/off_t.h"
 #include "vm/page.h"
 
-/* Lock for the frame table. */
+/* Lock for the frame table.
+
+   Locks are taken in this order: a thread's page_sema, then
+   filesys_lock, then frame_lock.  Eviction chooses its victims
+   under frame_lock and so only tries the other two there; it
+   writes mapped file pages back under filesys_lock only after
+   dropping frame_lock. */
 struct lock frame_lock;
 
-/* List of used frame. */
-struct list frame_list;
+/* frame structure for frame table.  There is one for every page
+   in the user pool, whether in use or not.
 
-/* frame structure for frame table. */
+   A frame holding a read-only executable page may be shared by
+   every process running that executable, a frame holding a page of
+   a file is shared by every process that maps the file, and a
+   process's pages are shared copy-on-write with the children it
+   forks.  Such a frame has no owning thread; each process that
+   maps it has a struct frame_mapping instead. */
 struct frame {
   //tid_t tid;                          /* Thread identifier. */
-  struct thread *t;					/* The thread the frame belongs to. */
+  struct thread *t;					/* The thread the frame belongs to, or NULL if free or shared. */
   uint32_t *user_page;				/* the pointer to the used user frame. */
   uint32_t *PTE;						/* the page table entry for the user page. */
   uint32_t *virtual_address;			/* the user virtual address for this frame. */
-  struct list_elem ft_elem;         	/* List frame element. */
   bool loaded;
+  unsigned pin_cnt;					/* Nonzero keeps the frame from being evicted. */
+  struct list_elem thread_elem;		/* Element in the owner's frames list. */
+
+  /* Shared frames only. */
+  bool shared;						/* True if this is a shared frame. */
+  bool cow;							/* Shared copy-on-write, not as executable text. */
+  bool mapped;						/* Page of a mapped file, writable in place. */
+  struct list mappings;				/* struct frame_mapping for each mapper. */
+
+  /* Shared executable and mapped file frames only. */
+  struct inode *inode;				/* The file's inode. */
+  disk_sector_t sector;				/* Inode sector of the file. */
+  off_t offset;						/* Offset of the page in the file. */
+  size_t zero_after;				/* Bytes of the page read from the file. */
+  struct hash_elem cache_elem;		/* Element in the shared page cache. */
+};
+
+/* One process's mapping of a shared frame. */
+struct frame_mapping {
+  struct frame *frame;				/* The shared frame. */
+  struct thread *t;					/* The mapping process. */
+  void *upage;						/* Where T maps it. */
+  uint32_t *PTE;					/* T's page table entry for UPAGE. */
+  bool writable;					/* T may write UPAGE, once it has its own copy. */
+  struct list_elem frame_elem;		/* Element in the frame's mappings list. */
+  struct list_elem thread_elem;		/* Element in T's shared_frames list. */
+};
+
+/* Page replacement policies. */
+enum ft_policy {
+  FT_CLOCK,                             /* Second chance, one hand. */
+  FT_TWO_HANDED                         /* Two-handed clock. */
 };
 
+/* Policy in use, and the distance in frames between the two
+   hands of the two-handed clock (0 picks a default). */
+extern enum ft_policy ft_policy;
+extern size_t ft_hand_spread;
+
 void ft_init (void);
+void ft_start_pageout (void);
 struct frame *ft_get_page (enum palloc_flags);
+struct frame *ft_try_get_page (enum palloc_flags);
+struct frame *ft_try_get_large_page (void);
 void ft_free_page (void *);
+void ft_release_page (void *upage);
+bool ft_pin_page (const void *upage, bool write);
+void ft_deactivate_page (void *upage);
+void ft_unpin_page (const void *upage);
 void ft_destroy (struct thread *);
+bool ft_map_shared (struct inode *, off_t, size_t zero_after, bool mapped,
+                    void *upage);
+bool ft_share_frame (struct frame *, struct inode *, off_t, size_t zero_after,
+                     bool mapped, void *upage);
+void ft_write_back (struct thread *, void *upage, struct file *, off_t,
+                    size_t bytes);
+off_t ft_file_read (struct file *, void *, off_t size);
+off_t ft_file_write (struct file *, const void *, off_t size);
+bool ft_fork (struct thread *parent, struct list *files);
+bool ft_copy_on_write (void *upage);
 
 #endif /*VM_FRAME_H_*/
@@ -7,10 +7,9 @@
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include <stdio.h>
 
-//static inline struct special_page_elem *add_lazy_page_unsafe (struct thread *t, struct special_page_elem *page);
-
 static unsigned
 page_hash (const struct hash_elem *element, void *aux UNUSED) {
   struct special_page_elem *page = hash_entry (element, struct special_page_elem, elem);
@@ -27,6 +26,7 @@ page_key_less (const struct hash_elem *a, const struct hash_elem *b, void *aux U
 void
 init_supplemental_pagetable (struct thread *t) {
   hash_init (&t->sup_pagetable, page_hash, page_key_less, NULL);
+  list_init (&t->vmas);
   sema_init (&t->page_sema, 1);
 }
 
@@ -47,41 +47,38 @@ add_lazy_page (struct thread *t, struct special_page_elem *page) {
   return results;
 }
 
+/* Supplemental page table records. */
+static struct slab_cache zero_page_cache;
+static struct slab_cache swap_page_cache;
+
+/* Initializes the supplemental page table record caches. */
+void
+page_init (void) {
+  slab_cache_init (&zero_page_cache, "zero_page", sizeof (struct zero_page),
+                   NULL);
+  slab_cache_init (&swap_page_cache, "swap_page", sizeof (struct swap_page),
+                   NULL);
+}
+
 struct zero_page *
 new_zero_page (uint32_t virtual_page) {
-  struct zero_page *zp = malloc (sizeof (struct zero_page));
+  struct zero_page *zp = slab_alloc (&zero_page_cache);
   zp->type = ZERO; zp->virtual_page = virtual_page;
   return zp;
 }
 
-struct exec_page *
-new_exec_page (uint32_t virtual_page, struct file *elf_file, 
-               size_t offset, size_t zero_after, bool writable) {
-  struct exec_page *ep = malloc (sizeof (struct exec_page));
-  ep->type = EXEC; ep->virtual_page = virtual_page; ep->elf_file = elf_file;
-  ep->offset = offset; ep->zero_after = zero_after; ep->writable = writable;
-  return ep;
-}
-
 struct swap_page *
-new_swap_page (uint32_t virtual_page, struct swap_slot *slot, 
-               bool dirty, struct special_page_elem *evicted_page){
-  struct swap_page *sp = malloc (sizeof (struct swap_page));
+new_swap_page (uint32_t virtual_page, swap_slot_t slot, struct zcache_entry *zentry,
+               bool dirty){
+  struct swap_page *sp = slab_alloc (&swap_page_cache);
   sp->type = SWAP; sp->virtual_page = virtual_page; sp->slot = slot;
-  sp->dirty = dirty; sp->evicted_page = evicted_page;
+  sp->zentry = zentry;
+  sp->dirty = dirty;
   return sp;
 }
 
-struct file_page *
-new_file_page (uint32_t virtual_page, struct file *elf_file, 
-               size_t offset, size_t zero_after) {
-  struct file_page *fp = malloc (sizeof (struct file_page));
-  fp->type = FILE; fp->virtual_page = virtual_page; fp->source_file = elf_file;
-  fp->offset = offset; fp->zero_after = zero_after;
-  return fp;
-}
-
-static struct special_page_elem *find_lazy_page_unsafe (struct thread *t, uint32_t ptr) {
+struct special_page_elem *
+find_lazy_page_unsafe (struct thread *t, uint32_t ptr) {
   ASSERT((ptr & 0xfffff000) != 0xccccc000);
   struct special_page_elem needle;
   needle.virtual_page = 0xfffff000 & ptr;
@@ -138,79 +135,198 @@ print_page_entry (struct special_page_elem *gen_page) {
     return;
   }
   printf("%s page mapped to 0x%08x", special_page_name(gen_page->type), gen_page->virtual_page);
-  switch (gen_page->type) {
-  case EXEC:
-    noop();
-    struct exec_page *exec_page = (struct exec_page*) gen_page;
-    printf(" from ");
-    print_file(exec_page->elf_file);
-    printf(" starting at offset %u", (unsigned)exec_page->offset);
-    if (exec_page->zero_after != 4096)
-      printf(", but zeroing after %u", (unsigned)exec_page->zero_after);
-    break;
-  default:
-    break;
+  printf("\n");
+}
+
+static void
+print_vma (struct vma *vma) {
+  if (vma->type == VMA_STACK) {
+    printf("STACK region 0x%08x-0x%08x\n", vma->start, vma->end);
+    return;
   }
+  printf("%s region 0x%08x-0x%08x from ", vma->type == VMA_EXEC ? "EXEC" : "FILE",
+         vma->start, vma->end);
+  print_file(vma->file);
+  printf(" starting at offset %u", (unsigned)vma->offset);
+  if (vma->read_bytes != vma->end - vma->start)
+    printf(", but zeroing after %u", (unsigned)vma->read_bytes);
   printf("\n");
 }
 
 void
 print_supplemental_page_table () {
+  struct list_elem *e;
+  lforeach (e, &thread_current ()->vmas)
+    print_vma (list_entry (e, struct vma, elem));
   hash_apply (&thread_current ()->sup_pagetable, print_page_entry_hf);
 }
 
 void
 expire_page (struct special_page_elem * gen_page) {
   struct thread *cur = thread_current ();
-  void *kpage = pagedir_get_page (cur->pagedir, (void *)gen_page->virtual_page);
-  if (kpage != NULL){
-    switch(gen_page->type) {
-    case FILE:
-      noop ();
-      struct file_page *file_page = (struct file_page *)gen_page;
-      if (pagedir_is_dirty (cur->pagedir, (void *)file_page->virtual_page)) {
-        lock_acquire (&filesys_lock);
-        file_write_at (file_page->source_file, (void *)file_page->virtual_page, 
-                       file_page->zero_after, file_page->offset);
-        lock_release (&filesys_lock);
-      }
-      break;
-    default:
+  if (gen_page->type == SWAP) {
+    /* The page lives only in swap, so give its space back. */
+    struct swap_page *swap_page = (struct swap_page *)gen_page;
+    if (swap_page->zentry != NULL)
+      zcache_free (swap_page->zentry);
+    else
+      swap_slot_free (swap_page->slot);
+  }
+  hash_delete (&cur->sup_pagetable, &gen_page->elem);
+  slab_free (gen_page);
+}
+
+/* Returns the entry for PARENT_FILE in FILES, a list of struct
+   fork_file, or a null pointer. */
+static struct fork_file *
+find_fork_file (struct list *files, struct file *parent_file) {
+  struct list_elem *e;
+  lforeach (e, files) {
+    struct fork_file *ff = list_entry (e, struct fork_file, elem);
+    if (ff->parent_file == parent_file)
+      return ff;
+  }
+  return NULL;
+}
+
+/* Gets the current process's mapped files ready for it to fork: a
+   handle is opened for the child on each file and added to FILES,
+   a list of struct fork_file.  Returns false if a file could not
+   be reopened. */
+bool
+fork_prepare_files (struct list *files) {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+  bool success = true;
+
+  sema_down (&cur->page_sema);
+  lforeach (e, &cur->vmas) {
+    struct vma *vma = list_entry (e, struct vma, elem);
+    struct fork_file *ff;
+
+    if (vma->type != VMA_FILE)
+      continue;
+
+    ff = malloc (sizeof *ff);
+    if (ff != NULL) {
+      lock_acquire (&filesys_lock);
+      ff->child_file = file_reopen (vma->file);
+      lock_release (&filesys_lock);
+    }
+    if (ff == NULL || ff->child_file == NULL) {
+      free (ff);
+      success = false;
       break;
     }
+    ff->parent_file = vma->file;
+    list_push_back (files, &ff->elem);
   }
-  hash_delete (&cur->sup_pagetable, &gen_page->elem);
-  free(gen_page);
+  sema_up (&cur->page_sema);
+  return success;
+}
+
+/* Returns a copy of GEN_PAGE for a forked child.  A swapped-out
+   page's slot or zcache entry is shared, not copied. */
+static struct special_page_elem *
+copy_page (struct special_page_elem *gen_page) {
+  switch (gen_page->type) {
+  case SWAP:
+    noop ();
+    struct swap_page *swap_page = (struct swap_page *) gen_page;
+    if (swap_page->zentry != NULL)
+      zcache_dup (swap_page->zentry);
+    else
+      swap_slot_dup (swap_page->slot);
+    return (struct special_page_elem *)
+      new_swap_page (swap_page->virtual_page, swap_page->slot,
+                     swap_page->zentry, swap_page->dirty);
+  case ZERO:
+    return (struct special_page_elem *) new_zero_page (gen_page->virtual_page);
+  }
+  NOT_REACHED ();
+}
+
+/* Copies PARENT's regions and supplemental page table into
+   CHILD's, which are empty, for fork().  FILES holds the child's
+   handles on PARENT's mapped files, from fork_prepare_files().
+   PARENT's page_sema must be held.  Returns false if memory ran
+   out. */
+bool
+fork_supplemental_pagetable (struct thread *child, struct thread *parent,
+                             struct list *files) {
+  struct hash_iterator i;
+  struct list_elem *e;
+
+  lforeach (e, &parent->vmas) {
+    struct vma *vma = list_entry (e, struct vma, elem);
+    struct file *file = vma->file;
+
+    if (vma->type == VMA_FILE) {
+      struct fork_file *ff = find_fork_file (files, vma->file);
+      ASSERT (ff != NULL);
+      file = ff->child_file;
+    }
+    if (vma_add (child, vma->type, vma->start, vma->end - vma->start, file,
+                 vma->offset, vma->read_bytes, vma->writable) == NULL)
+      return false;
+  }
+
+  hash_first (&i, &parent->sup_pagetable);
+  while (hash_next (&i)) {
+    struct special_page_elem *page =
+      copy_page (hash_entry (hash_cur (&i), struct special_page_elem, elem));
+    if (page == NULL)
+      return false;
+    add_lazy_page_unsafe (child, page);
+  }
+  return true;
 }
 
 static void expire_page_hf (struct hash_elem *element, void *aux UNUSED) {
   expire_page (hash_entry (element, struct special_page_elem, elem));
 }
 
+/* Writes back the dirty pages of T's mapped files, which is
+   exiting.  Its frames must still be resident, so this comes before
+   ft_destroy(). */
+void
+write_back_mapped_regions (struct thread *t) {
+  struct list_elem *e;
+
+  /* T is exiting, so nothing else changes its regions. */
+  lforeach (e, &t->vmas) {
+    struct vma *vma = list_entry (e, struct vma, elem);
+    if (vma->type == VMA_FILE)
+      vma_write_back (t, vma);
+  }
+}
+
+/* Frees T's supplemental page table and regions, closing its mapped
+   files.  T's frames must already have been freed by ft_destroy():
+   until then eviction may still add entries to the table. */
 void
 destroy_supplemental_pagetable (struct thread *t) {
   sema_down (&t->page_sema);
   hash_destroy (&t->sup_pagetable, expire_page_hf);
   sema_up (&t->page_sema);
+
+  while (!list_empty (&t->vmas)) {
+    struct vma *vma = list_entry (list_pop_front (&t->vmas), struct vma, elem);
+    if (vma->type == VMA_FILE) {
+      lock_acquire (&filesys_lock);
+      file_close (vma->file);
+      lock_release (&filesys_lock);
+    }
+    slab_free (vma);
+  }
 }
 
+/* Returns true if none of the current thread's regions overlaps
+   the LENGTH bytes from page UPAGE. */
 bool
-validate_free_page (void *upage, uint32_t read_bytes)
+validate_free_page (void *upage, uint32_t length)
 {
-	/* Failed if the range of pages mapped overlaps any existing set of mapping pages. 
-	   (Stack validation not implimented yet!) */
-	size_t num_of_pages = read_bytes / PGSIZE;
-	if (read_bytes % PGSIZE != 0)
-		num_of_pages++;
-	unsigned i;
-	uint32_t ptr = (uint32_t)upage;
-	struct special_page_elem *spe;
-	for(i = 0; i < num_of_pages; i++, ptr += PGSIZE)
-	{
-		spe = find_lazy_page(thread_current (), ptr);
-		if (spe != NULL)
-			return false; // This page has been already mapped.
-	}
-	
-	return true;
+  uint32_t start = (uint32_t) upage;
+
+  return !vma_overlaps (thread_current (), start, start + length);
 }
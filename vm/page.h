@@ -2,14 +2,18 @@
 #define VM_PAGE_H_
 #include "lib/kernel/hash.h"
 #include "filesys/file.h"
+#include "vm/swap.h"
+#include "vm/vma.h"
+#include "vm/zcache.h"
 
+/* Pages whose contents are not what their region (struct vma)
+   says, or that have no region, such as stack pages, once they
+   have been evicted. */
 enum special_page {
-  EXEC,
-  FILE,
   SWAP,
   ZERO
 };
-static const char *(special_page_names[]) = {"EXEC", "FILE", "SWAP", "ZERO", "STACK"};
+static const char *(special_page_names[]) = {"SWAP", "ZERO"};
 inline static const char * special_page_name(const enum special_page page_num) {
   return special_page_names[page_num];
 }
@@ -24,32 +28,13 @@ struct special_page_elem {
 };
 
 
-struct exec_page {
-  enum special_page type;
-  struct hash_elem elem;
-  uint32_t virtual_page;
-  struct file *elf_file;
-  size_t offset; //number of bytes into the file to start
-  size_t zero_after; //after this offset, the rest should be zeros
-  bool writable;
-};
-
-struct file_page {
-  enum special_page type;
-  struct hash_elem elem;
-  uint32_t virtual_page;
-  struct file *source_file;
-  size_t offset; //number of pages into the file
-  size_t zero_after; //after this offset, the rest should be zeros
-};
-
 struct swap_page {
   enum special_page type;
   struct hash_elem elem;
   uint32_t virtual_page;
-  struct swap_slot *slot;
+  swap_slot_t slot; //SWAP_SLOT_ERROR if the page is in zentry instead
+  struct zcache_entry *zentry; //compressed copy in the zcache, or NULL
   bool dirty; //Whether the page before evicting to SWAP is dirty or not. 
-  struct special_page_elem *evicted_page; //the evicted page before swaping
 };
 
 struct zero_page {
@@ -58,18 +43,32 @@ struct zero_page {
   uint32_t virtual_page;
 };
 
+/* A file mapped by a process that is forking, and the handle
+   opened on it for the child. */
+struct fork_file {
+  struct file *parent_file;
+  struct file *child_file;
+  struct list_elem elem;
+};
+
+void page_init (void);
 void init_supplemental_pagetable (struct thread *t);
+void write_back_mapped_regions (struct thread *t);
 void destroy_supplemental_pagetable (struct thread *t);
 struct special_page_elem * add_lazy_page (struct thread *t, struct special_page_elem *page);
 struct special_page_elem * find_lazy_page (struct thread *t, uint32_t ptr);
-bool validate_free_page (void *upage, uint32_t read_bytes);
+struct special_page_elem * add_lazy_page_unsafe (struct thread *t, struct special_page_elem *page);
+struct special_page_elem * find_lazy_page_unsafe (struct thread *t, uint32_t ptr);
+bool validate_free_page (void *upage, uint32_t length);
 void expire_page (struct special_page_elem * gen_page);
+bool fork_prepare_files (struct list *files);
+bool fork_supplemental_pagetable (struct thread *child, struct thread *parent,
+                                  struct list *files);
 void print_supplemental_page_table (void);
 void print_page_entry (struct special_page_elem *gen_page);
 struct zero_page *new_zero_page (uint32_t);
-struct exec_page *new_exec_page (uint32_t, struct file *, size_t, size_t, bool);
-struct file_page *new_file_page (uint32_t, struct file *, size_t, size_t);
-struct swap_page *new_swap_page (uint32_t, struct swap_slot *, bool, struct special_page_elem *);
+struct swap_page *new_swap_page (uint32_t, swap_slot_t, struct zcache_entry *,
+                                bool);
 
 static void noop (void);
 static inline void noop() {}
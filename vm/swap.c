@@ -1,183 +1,170 @@
 #include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
-#include "threads/malloc.h"
 #include "devices/disk.h"
 
-/* List of free swap slots. */
-static struct list free_swap_list;
+/* Bitmap of used swap slots, one bit per page-sized slot. */
+static struct bitmap *swap_map;
+
+/* Number of swapped-out pages sharing each slot.  A forked
+   process shares its parent's swapped-out pages until one of
+   them faults its copy back in. */
+static uint16_t *swap_refs;
+
+/* Slot to start the next free-slot search from.  Allocation
+   sweeps forward from here, so a run of evictions lands in
+   ascending slots without rescanning the used ones. */
+static size_t swap_cursor;
 
 /* Lock for the swap table. */
 static struct lock swap_lock;
 
-/* The disk that contains the file system. */
+/* The disk that contains the swap partition. */
 static struct disk *swap_disk;
 
-static disk_sector_t alloc_swap_slot (void);
-static void free_swap_slot (struct swap_slot *ss);
-static bool swap_slot_less(struct list_elem *a, struct list_elem *b, void *aux);
+static swap_slot_t alloc_swap_slots (size_t cnt);
 
 /* Initialize the swap table. */
 void
-swap_init (void) 
+swap_init (void)
 {
-  list_init (&free_swap_list);
   lock_init (&swap_lock);
-  
-  swap_disk = disk_get (1, 1);
-  
-  struct free_swap_slot *free_ss = malloc (sizeof (struct free_swap_slot));
-  free_ss->start = 0;
-  free_ss->size = disk_size(swap_disk);
 
-  lock_acquire (&swap_lock);
-  list_insert_ordered(&free_swap_list, &free_ss->free_swap_elem, (list_less_func *)swap_slot_less, NULL);
-  lock_release (&swap_lock);
+  swap_disk = disk_get (1, 1);
+  if (swap_disk == NULL)
+    PANIC ("couldn't open swap disk");
+
+  swap_map = bitmap_create (disk_size (swap_disk) / SECTORS_PER_FRAME);
+  if (swap_map == NULL)
+    PANIC ("couldn't allocate swap bitmap");
+  swap_refs = calloc (bitmap_size (swap_map), sizeof *swap_refs);
+  if (swap_refs == NULL)
+    PANIC ("couldn't allocate swap reference counts");
+  swap_cursor = 0;
 }
 
-/* Read the swap slot into the frame and return true if successful. */
+/* Read the swap slot into the frame and return true if successful.
+   The slot is released afterwards. */
 bool
-swap_slot_read (void *frame, struct swap_slot* ss)
+swap_slot_read (void *frame, swap_slot_t slot)
 {
-	off_t pos = 0;
-
 	if (frame == NULL)
     return false;
 
-	disk_sector_t start = ss->start;
-	
-	/* Read from the swap disk into frame. */
-	for (pos = 0; pos < PGSIZE; pos += DISK_SECTOR_SIZE, start++)
-		disk_read(swap_disk, start, frame + pos);
+	return swap_slots_read (&frame, slot, 1);
+}
+
+/* Read the CNT consecutive swap slots starting at FIRST with a
+   single multi-sector transfer, slot FIRST + I into FRAMES[I].
+   The slots are released afterwards. */
+bool
+swap_slots_read (void *const frames[], swap_slot_t first, size_t cnt)
+{
+	void *sectors[SWAP_CLUSTER_MAX * SECTORS_PER_FRAME];
+	size_t i, j;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER_MAX);
+
+	for (i = 0; i < cnt; i++)
+		for (j = 0; j < SECTORS_PER_FRAME; j++)
+			sectors[i * SECTORS_PER_FRAME + j] = frames[i] + j * DISK_SECTOR_SIZE;
+
+	/* Read from the swap disk into the frames. */
+	disk_read_multiple (swap_disk, first * SECTORS_PER_FRAME,
+	                    cnt * SECTORS_PER_FRAME, sectors);
+
+	for (i = 0; i < cnt; i++)
+		swap_slot_free (first + i);
 
-	free_swap_slot(ss);
-	
 	return true;
 }
 
-/* Write one frame of thread t to the swap disk. Return that swap slot if successful. 
-   Otherwise, return NULL. */
-struct swap_slot*
+/* Write one frame to the swap disk.  Return the swap slot it was
+   written to if successful, otherwise SWAP_SLOT_ERROR. */
+swap_slot_t
 swap_slot_write (void *frame)
 {
-	off_t pos;
-	struct swap_slot *ss = NULL;
-	
-	if (frame != NULL)
-	{
-		disk_sector_t start = alloc_swap_slot();
-		
-		if (start != disk_size(swap_disk)+1)
-		{
-			ss = malloc (sizeof (struct swap_slot));
-			//ss->tid = t->tid;
-			ss->start = start;
-			
-			/* Write to the swap disk from frame. */
-			for (pos = 0; pos < PGSIZE; pos += DISK_SECTOR_SIZE, start++)
-				disk_write(swap_disk, start, frame + pos);	
-		}	
-	}
-	
-	return ss;
+	if (frame == NULL)
+		return SWAP_SLOT_ERROR;
+
+	return swap_slots_write (&frame, 1);
+}
+
+/* Write the CNT frames in FRAMES to CNT consecutive swap slots
+   with a single multi-sector transfer, so that FRAMES[I] ends up
+   in the returned slot plus I.  Returns SWAP_SLOT_ERROR, writing
+   nothing, if there is no run of CNT free slots. */
+swap_slot_t
+swap_slots_write (void *const frames[], size_t cnt)
+{
+	const void *sectors[SWAP_CLUSTER_MAX * SECTORS_PER_FRAME];
+	size_t i, j;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER_MAX);
+
+	swap_slot_t slot = alloc_swap_slots (cnt);
+	if (slot == SWAP_SLOT_ERROR)
+		return SWAP_SLOT_ERROR;
+
+	for (i = 0; i < cnt; i++)
+		for (j = 0; j < SECTORS_PER_FRAME; j++)
+			sectors[i * SECTORS_PER_FRAME + j] = frames[i] + j * DISK_SECTOR_SIZE;
+
+	/* Write to the swap disk from the frames. */
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_FRAME,
+	                     cnt * SECTORS_PER_FRAME, sectors);
+
+	return slot;
 }
 
-/* Allocate a swap slot from swap disk. */
-static disk_sector_t
-alloc_swap_slot (void)
+/* Add a reference to SLOT, which is in use, for another page that
+   shares its contents. */
+void
+swap_slot_dup (swap_slot_t slot)
 {
-	disk_sector_t start = disk_size(swap_disk)+1; // Define as the false sector.
-	
-	lock_acquire (&swap_lock);
-	
-	if (!list_empty (&free_swap_list))
-	{
-		struct free_swap_slot *free_ss;
-	    struct list_elem *elem;
-
-		lforeach(elem, &free_swap_list)
-		{
-			free_ss = list_entry (elem, struct free_swap_slot, free_swap_elem);
-			if (free_ss->size >= SECTORS_PER_FRAME)
-				break;
-		}
-		
-		if (elem != list_end(&free_swap_list))
-		{
-			start = free_ss->start;
-			
-			if (free_ss->size == SECTORS_PER_FRAME)
-			{
-				list_remove(&free_ss->free_swap_elem);
-				free(free_ss);
-			}	
-			else
-			{
-				free_ss->start += SECTORS_PER_FRAME;
-				free_ss->size -= SECTORS_PER_FRAME;
-			}			
-		}
-	}	
-
-	lock_release (&swap_lock);
-	
-	return start;
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot));
+  ASSERT (swap_refs[slot] < UINT16_MAX);
+  swap_refs[slot]++;
+  lock_release (&swap_lock);
 }
 
-/* Free a swap slot to swap disk. */
-static void
-free_swap_slot (struct swap_slot *ss)
+/* Drop a reference to SLOT, and release it so that it can be
+   handed out again once no page refers to it. */
+void
+swap_slot_free (swap_slot_t slot)
 {
-	  struct free_swap_slot *free_ss = malloc (sizeof (struct free_swap_slot));
-	  free_ss->start = ss->start;
-	  free_ss->size = SECTORS_PER_FRAME;
-
-	  lock_acquire (&swap_lock);
-	  
-	  list_insert_ordered(&free_swap_list, &free_ss->free_swap_elem, (list_less_func *)swap_slot_less, NULL);
-	  
-	  struct free_swap_slot *temp_free_ss;
-	  struct list_elem *temp_elem = list_next(&free_ss->free_swap_elem);
-	  
-	  /* Try to merge with the swap slot on the right. */
-	  if (temp_elem != list_end(&free_swap_list))
-	  {
-		  temp_free_ss = list_entry (temp_elem, struct free_swap_slot, free_swap_elem);	
-		  if (free_ss->start + free_ss->size == temp_free_ss->start)
-		  {
-			  free_ss->size += temp_free_ss->size;
-			  list_remove(temp_elem);
-			  free (temp_free_ss);
-		  }	  
-	  }	  
-	  	  
-	  /* Try to merge with the swap slot on the left. */
-	  if (&free_ss->free_swap_elem != list_begin(&free_swap_list))
-	  {
-		  temp_free_ss = list_entry (list_prev(&free_ss->free_swap_elem), struct free_swap_slot, free_swap_elem);	
-		  if (free_ss->start == temp_free_ss->start + temp_free_ss->size)
-		  {
-			  temp_free_ss->size += free_ss->size;
-			  list_remove(&free_ss->free_swap_elem);
-			  free (free_ss);
-		  }	  
-	  }	  
-	  
-	  lock_release (&swap_lock);
-	  free(ss);
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot) && swap_refs[slot] > 0);
+  if (--swap_refs[slot] == 0)
+    bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
 }
 
-/* swap slot comparison function */
-static bool swap_slot_less(struct list_elem *a, struct list_elem *b, void *aux UNUSED)
+/* Allocate CNT consecutive swap slots from swap disk and return
+   the first, searching forward from the cursor and wrapping
+   around to the start of the disk once. */
+static swap_slot_t
+alloc_swap_slots (size_t cnt)
 {
-    bool rv = false;
-    struct free_swap_slot *fss_a, *fss_b;
-    fss_a = list_entry(a, struct free_swap_slot, free_swap_elem);
-    fss_b = list_entry(b, struct free_swap_slot, free_swap_elem);    
-    
-    if (fss_a->start < fss_b->start) 
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, swap_cursor, cnt, false);
+  if (slot == BITMAP_ERROR && swap_cursor != 0)
+    slot = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+  if (slot != BITMAP_ERROR)
     {
-        rv = true;
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        swap_refs[slot + i] = 1;
+      swap_cursor = slot + cnt;
     }
-    return rv;
+  lock_release (&swap_lock);
+
+  return slot != BITMAP_ERROR ? slot : SWAP_SLOT_ERROR;
 }
@@ -1,29 +1,28 @@
 #ifndef VM_SWAP_H_
 #define VM_SWAP_H_
 
-#include <list.h>
-#include <stdlib.h>
-#include "threads/thread.h"
-#include "threads/palloc.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 /* The number of sectors in each frame. */
 #define SECTORS_PER_FRAME 8
 
-/* frame structure for frame table. */
-struct swap_slot
-{
-    disk_sector_t start;                /* First data sector of the swap slot. */
-};
+/* Index of a page-sized slot on the swap disk.  Slot N occupies
+   sectors N * SECTORS_PER_FRAME through
+   (N + 1) * SECTORS_PER_FRAME - 1. */
+typedef size_t swap_slot_t;
+#define SWAP_SLOT_ERROR SIZE_MAX        /* No slot available. */
 
-struct free_swap_slot
-{
-    disk_sector_t start;                /* First data sector of the free swap slot. */
-    size_t size;						/* Size of this free slot in sectors. */
-    struct list_elem free_swap_elem;    /* List free swap element. */
-};
+/* Most frames read from or written to swap with one transfer. */
+#define SWAP_CLUSTER_MAX 8
 
 void swap_init (void);
-bool swap_slot_read (void *frame, struct swap_slot* ss);
-struct swap_slot* swap_slot_write (void *frame);
+bool swap_slot_read (void *frame, swap_slot_t slot);
+bool swap_slots_read (void *const frames[], swap_slot_t first, size_t cnt);
+swap_slot_t swap_slot_write (void *frame);
+swap_slot_t swap_slots_write (void *const frames[], size_t cnt);
+void swap_slot_dup (swap_slot_t slot);
+void swap_slot_free (swap_slot_t slot);
 
 #endif /*VM_SWAP_H_*/
@@ -0,0 +1,420 @@
+#include "vm/vma.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/pte.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+
+/* A thread's regions are kept in a list sorted by start address.
+   A process has a handful of them, its executable's segments and
+   whatever files it maps, so a list walk finds one quickly.
+
+   A thread's regions change only in its own context, or while it
+   is blocked in fork(), and only with its page_sema held.  Only
+   the owner and fork() read them; eviction finds everything it
+   needs in the frame table. */
+
+/* Regions. */
+static struct slab_cache vma_cache;
+
+/* Initializes the region cache. */
+void
+vma_init (void)
+{
+  slab_cache_init (&vma_cache, "vma", sizeof (struct vma), NULL);
+}
+
+static bool
+vma_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED)
+{
+  const struct vma *a = list_entry (a_, struct vma, elem);
+  const struct vma *b = list_entry (b_, struct vma, elem);
+  return a->start < b->start;
+}
+
+/* Adds a region to T covering the LENGTH bytes from page START,
+   rounded up to whole pages, whose first READ_BYTES bytes come
+   from FILE at OFFSET.  Returns the region, or a null pointer if
+   memory ran out.  The region must not overlap any other.  It is
+   freed with slab_free(). */
+struct vma *
+vma_add (struct thread *t, enum vma_type type, uint32_t start, size_t length,
+         struct file *file, off_t offset, size_t read_bytes, bool writable)
+{
+  struct vma *vma;
+
+  ASSERT (pg_ofs ((void *) start) == 0);
+  ASSERT (read_bytes <= length);
+
+  vma = slab_alloc (&vma_cache);
+  if (vma == NULL)
+    return NULL;
+  vma->type = type;
+  vma->start = start;
+  vma->end = start + ROUND_UP (length, PGSIZE);
+  vma->file = file;
+  vma->offset = offset;
+  vma->read_bytes = read_bytes;
+  vma->writable = writable;
+  vma->advice = VMA_NORMAL;
+  list_insert_ordered (&t->vmas, &vma->elem, vma_less, NULL);
+  return vma;
+}
+
+/* Returns T's region containing ADDR, or a null pointer. */
+struct vma *
+vma_find (struct thread *t, uint32_t addr)
+{
+  struct list_elem *e;
+
+  lforeach (e, &t->vmas)
+    {
+      struct vma *vma = list_entry (e, struct vma, elem);
+      if (addr < vma->start)
+        break;
+      if (addr < vma->end)
+        return vma;
+    }
+  return NULL;
+}
+
+/* Returns true if any of T's regions overlaps the range from START
+   up to END. */
+bool
+vma_overlaps (struct thread *t, uint32_t start, uint32_t end)
+{
+  struct list_elem *e;
+
+  lforeach (e, &t->vmas)
+    {
+      struct vma *vma = list_entry (e, struct vma, elem);
+      if (end <= vma->start)
+        break;
+      if (start < vma->end)
+        return true;
+    }
+  return false;
+}
+
+/* Removes VMA from its thread's regions.  The caller frees it
+   with slab_free(). */
+void
+vma_remove (struct vma *vma)
+{
+  list_remove (&vma->elem);
+}
+
+/* Returns the offset in VMA's file of page UPAGE of VMA. */
+off_t
+vma_page_offset (const struct vma *vma, uint32_t upage)
+{
+  return vma->offset + (upage - vma->start);
+}
+
+/* Returns how many bytes of page UPAGE of VMA come from the file;
+   the rest of the page is zeros. */
+size_t
+vma_page_bytes (const struct vma *vma, uint32_t upage)
+{
+  size_t done = upage - vma->start;
+
+  if (done >= vma->read_bytes)
+    return 0;
+  return vma->read_bytes - done < PGSIZE ? vma->read_bytes - done : PGSIZE;
+}
+
+/* Writes the resident pages of VMA, a mapped file of T, that T has
+   written to back to the file and marks them clean.  Clean pages
+   cost nothing.  T's page_sema must not be held. */
+void
+vma_write_back (struct thread *t, struct vma *vma)
+{
+  uint32_t upage;
+
+  ASSERT (vma->type == VMA_FILE);
+
+  for (upage = vma->start; upage < vma->end; upage += PGSIZE)
+    ft_write_back (t, (void *) upage, vma->file,
+                   vma_page_offset (vma, upage),
+                   vma_page_bytes (vma, upage));
+}
+
+/* Most pages of a region brought in by one fault, counting the
+   page that faulted, and the most a sequential region reads ahead. */
+#define FAULT_AROUND 8
+#define READ_AHEAD (2 * FAULT_AROUND)
+
+/* Loads page UPAGE of the current thread's region VMA, if it is in
+   the region, holds file data, and is neither resident nor
+   recorded in the supplemental page table, and maps it with its
+   accessed bit clear.  Returns true if the page was mapped, false
+   if not. */
+static bool
+map_ahead (struct vma *vma, uint32_t upage)
+{
+  struct thread *cur = thread_current ();
+  struct inode *inode = file_get_inode (vma->file);
+  bool mapped = vma->type == VMA_FILE;
+  bool shared = mapped || !vma->writable;
+  struct frame *frame;
+  size_t bytes;
+  off_t offset;
+  bool read_ok;
+
+  if (upage < vma->start || upage >= vma->end)
+    return false;
+  bytes = vma_page_bytes (vma, upage);
+  offset = vma_page_offset (vma, upage);
+  if (bytes == 0 || pagedir_get_page (cur->pagedir, (void *) upage) != NULL
+      || find_lazy_page (cur, upage) != NULL)
+    return false;
+
+  /* A page another process has already read costs nothing. */
+  if (shared && ft_map_shared (inode, offset, bytes, mapped, (void *) upage))
+    return true;
+
+  /* Only take frames that are already free, so that loading ahead
+     never evicts anything. */
+  frame = ft_try_get_page (PAL_USER);
+  if (frame == NULL)
+    return false;
+  lock_acquire (&filesys_lock);
+  read_ok = file_read_at (vma->file, frame->user_page, bytes, offset)
+            == (int) bytes;
+  lock_release (&filesys_lock);
+  if (!read_ok)
+    {
+      ft_free_page (frame->user_page);
+      return false;
+    }
+  memset ((uint8_t *) frame->user_page + bytes, 0, PGSIZE - bytes);
+
+  if (shared)
+    return ft_share_frame (frame, inode, offset, bytes, mapped,
+                           (void *) upage);
+
+  lock_acquire (&frame_lock);
+  if (!install_page ((void *) upage, frame, vma->writable))
+    {
+      lock_release (&frame_lock);
+      ft_free_page (frame->user_page);
+      return false;
+    }
+  frame->virtual_address = (uint32_t *) upage;
+  frame->loaded = true;
+  lock_release (&frame_lock);
+  return true;
+}
+
+/* Having just mapped FAULT_PAGE of the current thread's region VMA,
+   maps the pages around it as well, as VMA's advice suggests,
+   stopping in each direction at the first page that can't be
+   mapped.
+
+   A file's data is contiguous on disk, so neighbouring pages of a
+   region are neighbouring sectors, and a program starting up or a
+   process reading through a mapped file takes one fault per
+   FAULT_AROUND pages instead of one per page: following pages
+   first, then preceding ones.  A sequential region reads further
+   ahead and nothing behind, and marks the pages it has passed as
+   the first to evict.  A random one gets just the page that
+   faulted.  As with swap read-around, pages that turn out not to
+   be wanted have their accessed bits clear and are the first the
+   clock evicts. */
+void
+vma_fault_around (struct vma *vma, uint32_t fault_page)
+{
+  uint32_t upage;
+  size_t cnt = 1;
+
+  switch (vma->advice)
+    {
+    case VMA_RANDOM:
+      return;
+
+    case VMA_SEQUENTIAL:
+      for (upage = fault_page + PGSIZE;
+           cnt < READ_AHEAD && map_ahead (vma, upage); upage += PGSIZE)
+        cnt++;
+      for (upage = fault_page - PGSIZE, cnt = 0;
+           upage >= vma->start && cnt < READ_AHEAD; upage -= PGSIZE, cnt++)
+        ft_deactivate_page ((void *) upage);
+      return;
+
+    default:
+      for (upage = fault_page + PGSIZE;
+           cnt < FAULT_AROUND && map_ahead (vma, upage); upage += PGSIZE)
+        cnt++;
+      for (upage = fault_page - PGSIZE;
+           cnt < FAULT_AROUND && map_ahead (vma, upage); upage -= PGSIZE)
+        cnt++;
+      return;
+    }
+}
+
+/* Loads and maps as many of the current thread's pages in VMA as
+   there are free frames for, without evicting anything. */
+void
+vma_prefetch (struct vma *vma)
+{
+  uint32_t upage;
+
+  for (upage = vma->start; upage < vma->end; upage += PGSIZE)
+    map_ahead (vma, upage);
+}
+
+/* With -lp, loads the whole 4 MB span of the current thread's
+   region VMA that holds FAULT_PAGE into a 4 MB block of free
+   frames and maps it as a single large page, so that it takes one
+   TLB entry instead of 1024.  Returns true if it did, false if
+   the caller should load just the page that faulted.
+
+   Only the writable segments of an executable, whose pages belong
+   to one process, are mapped this way; read-only ones and mapped
+   files are shared a page at a time through the page cache.  The
+   region must cover the span, and none of the span's pages may be
+   resident or recorded in the supplemental page table.  Like
+   fault-around, this only takes frames that are already free.
+   The large page is split back into 4 kB pages as soon as one of
+   them has to be dealt with on its own; see pagedir.c. */
+bool
+vma_map_large (struct vma *vma, uint32_t fault_page)
+{
+  struct thread *cur = thread_current ();
+  uint32_t span = fault_page & ~(PTSPAN - 1);
+  struct frame *frames;
+  uint32_t upage;
+  bool success = true;
+  size_t i;
+
+  if (!large_pages || vma->type != VMA_EXEC || !vma->writable
+      || span < vma->start || span + PTSPAN > vma->end
+      || !pagedir_large_page_fits (cur->pagedir, (void *) span))
+    return false;
+  for (upage = span; upage < span + PTSPAN; upage += PGSIZE)
+    if (find_lazy_page (cur, upage) != NULL)
+      return false;
+
+  frames = ft_try_get_large_page ();
+  if (frames == NULL)
+    return false;
+
+  lock_acquire (&filesys_lock);
+  for (i = 0, upage = span; success && i < PTPAGES; i++, upage += PGSIZE)
+    {
+      uint8_t *kpage = (uint8_t *) frames[i].user_page;
+      size_t bytes = vma_page_bytes (vma, upage);
+
+      if (bytes > 0)
+        success = file_read_at (vma->file, kpage, bytes,
+                                vma_page_offset (vma, upage)) == (int) bytes;
+      memset (kpage + bytes, 0, PGSIZE - bytes);
+    }
+  lock_release (&filesys_lock);
+
+  if (success)
+    {
+      lock_acquire (&frame_lock);
+      success = pagedir_set_large_page (cur->pagedir, (void *) span, frames,
+                                        true);
+      if (success)
+        for (i = 0, upage = span; i < PTPAGES; i++, upage += PGSIZE)
+          {
+            frames[i].virtual_address = (uint32_t *) upage;
+            frames[i].loaded = true;
+          }
+      lock_release (&frame_lock);
+    }
+
+  if (!success)
+    for (i = 0; i < PTPAGES; i++)
+      ft_free_page (frames[i].user_page);
+  return success;
+}
+
+/* Returns true if a fault at ADDR in the stack region VMA, with
+   the stack pointer at ESP, may grow the stack: ADDR must be above
+   the guard page and no more than 32 bytes below ESP, which PUSHA
+   can write to before it moves the stack pointer. */
+bool
+vma_stack_access (const struct vma *vma, const void *addr, const void *esp)
+{
+  ASSERT (vma->type == VMA_STACK);
+
+  return (uint32_t) addr >= vma->start + PGSIZE
+         && (const uint8_t *) addr + 32 >= (const uint8_t *) esp;
+}
+
+/* Most stack pages mapped by one growth fault, counting the page
+   that faulted. */
+#define STACK_GROW_BATCH 8
+
+/* Maps a fresh zero page at UPAGE of the current thread's stack
+   region VMA, if UPAGE is above the guard page and neither
+   resident nor recorded in the supplemental page table.  Returns
+   true if the page was mapped, false if not. */
+static bool
+map_stack_page (struct vma *vma, uint32_t upage)
+{
+  struct thread *cur = thread_current ();
+  struct frame *frame;
+
+  if (upage < vma->start + PGSIZE || upage >= vma->end
+      || pagedir_get_page (cur->pagedir, (void *) upage) != NULL
+      || find_lazy_page (cur, upage) != NULL)
+    return false;
+
+  /* Only take frames that are already free, so that growing the
+     stack ahead of need never evicts anything. */
+  frame = ft_try_get_page (PAL_USER | PAL_ZERO);
+  if (frame == NULL)
+    return false;
+
+  lock_acquire (&frame_lock);
+  if (!install_page ((void *) upage, frame, true))
+    {
+      lock_release (&frame_lock);
+      ft_free_page (frame->user_page);
+      return false;
+    }
+  frame->virtual_address = (uint32_t *) upage;
+  frame->loaded = true;
+  lock_release (&frame_lock);
+  return true;
+}
+
+/* Having just mapped a zero page at FAULT_PAGE to grow the current
+   thread's stack region VMA, with the stack pointer at ESP, maps
+   more of the stack around it, up to STACK_GROW_BATCH pages in all.
+
+   A function with a big stack frame moves the stack pointer down
+   many pages at once and then fills the frame in from the bottom
+   up, so the untouched pages above FAULT_PAGE are mapped first.
+   If the fault is at or below the stack pointer's page the stack
+   is growing down, as in deep recursion, and pages below it are
+   mapped too.  Either way the stack takes one fault per batch
+   instead of one per page.  The extra pages have their accessed
+   bits clear, so if they go unused the clock takes them first. */
+void
+vma_grow_stack (struct vma *vma, uint32_t fault_page, const void *esp)
+{
+  uint32_t upage;
+  size_t cnt = 1;
+
+  for (upage = fault_page + PGSIZE;
+       cnt < STACK_GROW_BATCH && map_stack_page (vma, upage);
+       upage += PGSIZE)
+    cnt++;
+  if (fault_page <= (uint32_t) pg_round_down (esp))
+    for (upage = fault_page - PGSIZE;
+         cnt < STACK_GROW_BATCH && map_stack_page (vma, upage);
+         upage -= PGSIZE)
+      cnt++;
+}
@@ -0,0 +1,70 @@
+#ifndef VM_VMA_H_
+#define VM_VMA_H_
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "filesys/off_t.h"
+
+struct thread;
+
+/* Kinds of region. */
+enum vma_type {
+  VMA_EXEC,                     /* Segment of the executable. */
+  VMA_FILE,                     /* Memory-mapped file. */
+  VMA_STACK                     /* User stack, zero-filled on demand. */
+};
+
+/* Advice from madvise(), numbered as the MADV_* values in
+   lib/user/syscall.h.  A region only keeps the first three; the
+   others are acted on at once. */
+enum vma_advice {
+  VMA_NORMAL,                   /* Fault around pages either side. */
+  VMA_SEQUENTIAL,               /* Read ahead further, drop behind. */
+  VMA_RANDOM,                   /* Fault in one page at a time. */
+  VMA_WILLNEED,                 /* Load the region now. */
+  VMA_DONTNEED                  /* Write back and drop the region now. */
+};
+
+/* A contiguous, page-aligned region of a process's address space
+   whose pages are loaded lazily from a file: READ_BYTES bytes
+   starting at OFFSET, then zeros up to END.  The stack region has
+   no file, so its pages are all zeros; it covers the most the
+   stack may grow to, and its lowest page is a guard that is never
+   mapped.
+
+   One of these stands for every page of the region, however big,
+   so loading an executable or mapping a file allocates nothing
+   per page.  Pages evicted to swap or known to be all zeros get
+   records in the supplemental page table, which take precedence
+   over their region. */
+struct vma {
+  enum vma_type type;
+  uint32_t start;               /* First page. */
+  uint32_t end;                 /* Page just past the last. */
+  struct file *file;            /* File the pages come from. */
+  off_t offset;                 /* Offset in FILE of START. */
+  size_t read_bytes;            /* Bytes read from FILE; rest is zeros. */
+  bool writable;                /* Mapped files are always writable. */
+  enum vma_advice advice;       /* How the pages are expected to be used. */
+  struct list_elem elem;        /* Element in thread's vmas, by START. */
+};
+
+void vma_init (void);
+struct vma *vma_add (struct thread *, enum vma_type, uint32_t start,
+                     size_t length, struct file *, off_t offset,
+                     size_t read_bytes, bool writable);
+struct vma *vma_find (struct thread *, uint32_t addr);
+bool vma_overlaps (struct thread *, uint32_t start, uint32_t end);
+void vma_remove (struct vma *);
+off_t vma_page_offset (const struct vma *, uint32_t upage);
+size_t vma_page_bytes (const struct vma *, uint32_t upage);
+void vma_write_back (struct thread *, struct vma *);
+void vma_fault_around (struct vma *, uint32_t fault_page);
+void vma_prefetch (struct vma *);
+bool vma_map_large (struct vma *, uint32_t fault_page);
+bool vma_stack_access (const struct vma *, const void *addr, const void *esp);
+void vma_grow_stack (struct vma *, uint32_t fault_page, const void *esp);
+
+#endif /*VM_VMA_H_*/
@@ -0,0 +1,267 @@
+#include "vm/zcache.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A compressed RAM cache in front of the swap disk.
+
+   Evicted anonymous pages are compressed with a small LZ77 coder
+   and kept in malloc() blocks, so that faulting them back in costs
+   a decompression instead of a disk read.  A page is only let in
+   if it fits in one of malloc()'s largest descriptor blocks,
+   i.e. compresses to a quarter of its size or better; everything
+   else, and everything once the cache is full, goes to swap.
+
+   The compressed format is a sequence of tokens.  A token byte
+   below 0x80 is followed by that many plus one literal bytes.
+   Any other token byte T is followed by a 16-bit little-endian
+   offset OFS and means "copy (T & 0x7f) + MIN_MATCH bytes
+   starting OFS bytes back in the output". */
+
+/* Compressed page. */
+struct zcache_entry
+  {
+    unsigned ref_cnt;           /* Swapped-out pages sharing it. */
+    size_t size;                /* Bytes of compressed data. */
+    uint8_t data[];             /* Compressed data. */
+  };
+
+/* Largest entry, header included.  Anything bigger would be a
+   malloc() big block, which costs as much as the page itself. */
+#define ZCACHE_MAX_ENTRY 1024
+#define ZCACHE_MAX_DATA (ZCACHE_MAX_ENTRY - sizeof (struct zcache_entry))
+
+#define MIN_MATCH 3                     /* Shortest match coded. */
+#define MAX_MATCH (0x7f + MIN_MATCH)    /* Longest match coded. */
+#define MAX_LITERALS 0x80               /* Longest literal run. */
+#define HASH_BITS 10                    /* Match finder table size. */
+
+size_t zcache_page_limit = 64;
+
+/* Bytes of kernel memory held by entries. */
+static size_t zcache_bytes;
+
+/* Statistics. */
+static long long store_cnt;     /* Pages stored. */
+static long long load_cnt;      /* Pages loaded. */
+static long long reject_cnt;    /* Pages that didn't compress. */
+static long long full_cnt;      /* Pages turned away for lack of room. */
+
+/* Protects the cache, the statistics and the buffers below. */
+static struct lock zcache_lock;
+
+/* Match finder table, holding the offset plus one of the last
+   position seen with each hash.  Too big for a kernel stack. */
+static uint16_t hash_table[1 << HASH_BITS];
+
+/* Compression output buffer. */
+static uint8_t zbuf[ZCACHE_MAX_DATA];
+
+static size_t compress (const uint8_t *, uint8_t *, size_t);
+static void decompress (const uint8_t *, size_t, uint8_t *);
+static size_t block_size (size_t);
+
+/* Initializes the compressed cache. */
+void
+zcache_init (void)
+{
+  lock_init (&zcache_lock);
+}
+
+/* Compresses PAGE into a new cache entry and returns it, or
+   returns a null pointer if PAGE does not compress well enough
+   or the cache is full.  The caller keeps PAGE. */
+struct zcache_entry *
+zcache_store (const void *page)
+{
+  struct zcache_entry *e = NULL;
+  size_t size, bytes;
+
+  lock_acquire (&zcache_lock);
+  if (zcache_bytes + ZCACHE_MAX_ENTRY > zcache_page_limit * PGSIZE)
+    full_cnt++;
+  else if ((size = compress (page, zbuf, sizeof zbuf)) == 0)
+    reject_cnt++;
+  else
+    {
+      bytes = sizeof *e + size;
+      e = malloc (bytes);
+      if (e != NULL)
+        {
+          e->ref_cnt = 1;
+          e->size = size;
+          memcpy (e->data, zbuf, size);
+          zcache_bytes += block_size (bytes);
+          store_cnt++;
+        }
+      else
+        full_cnt++;
+    }
+  lock_release (&zcache_lock);
+
+  return e;
+}
+
+/* Adds a reference to E for another page that shares it. */
+void
+zcache_dup (struct zcache_entry *e)
+{
+  lock_acquire (&zcache_lock);
+  e->ref_cnt++;
+  lock_release (&zcache_lock);
+}
+
+/* Decompresses E into PAGE and drops a reference to E. */
+void
+zcache_load (void *page, struct zcache_entry *e)
+{
+  decompress (e->data, e->size, page);
+
+  lock_acquire (&zcache_lock);
+  load_cnt++;
+  lock_release (&zcache_lock);
+
+  zcache_free (e);
+}
+
+/* Drops a reference to E without reading it, freeing E once no
+   page refers to it. */
+void
+zcache_free (struct zcache_entry *e)
+{
+  bool last;
+
+  lock_acquire (&zcache_lock);
+  last = --e->ref_cnt == 0;
+  if (last)
+    zcache_bytes -= block_size (sizeof *e + e->size);
+  lock_release (&zcache_lock);
+
+  if (last)
+    free (e);
+}
+
+/* Prints compressed cache statistics. */
+void
+zcache_print_stats (void)
+{
+  printf ("Zcache: %lld pages stored, %lld loaded, "
+          "%lld incompressible, %lld spilled when full\n",
+          store_cnt, load_cnt, reject_cnt, full_cnt);
+}
+
+/* Returns the size of the malloc() block that holds SIZE bytes. */
+static size_t
+block_size (size_t size)
+{
+  size_t b = 16;
+
+  while (b < size)
+    b *= 2;
+  return b;
+}
+
+/* Returns the match finder hash of the MIN_MATCH bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends the literals from LIT up to END to *OP, which may not
+   grow past OP_END.  Returns false if they don't fit. */
+static bool
+put_literals (uint8_t **op, uint8_t *op_end,
+              const uint8_t *lit, const uint8_t *end)
+{
+  while (lit < end)
+    {
+      size_t n = end - lit;
+      if (n > MAX_LITERALS)
+        n = MAX_LITERALS;
+      if (*op + 1 + n > op_end)
+        return false;
+      *(*op)++ = n - 1;
+      memcpy (*op, lit, n);
+      *op += n;
+      lit += n;
+    }
+  return true;
+}
+
+/* Compresses the page at SRC into DST, which holds DST_SIZE
+   bytes.  Returns the compressed size, or 0 if it would exceed
+   DST_SIZE. */
+static size_t
+compress (const uint8_t *src, uint8_t *dst, size_t dst_size)
+{
+  const uint8_t *ip = src, *lit = src, *end = src + PGSIZE;
+  uint8_t *op = dst, *op_end = dst + dst_size;
+
+  memset (hash_table, 0, sizeof hash_table);
+  while (ip + MIN_MATCH <= end)
+    {
+      unsigned h = hash3 (ip);
+      const uint8_t *ref = hash_table[h] ? src + hash_table[h] - 1 : NULL;
+
+      hash_table[h] = ip - src + 1;
+      if (ref != NULL && !memcmp (ref, ip, MIN_MATCH))
+        {
+          size_t len = MIN_MATCH;
+          size_t ofs = ip - ref;
+
+          while (len < MAX_MATCH && ip + len < end && ref[len] == ip[len])
+            len++;
+          if (!put_literals (&op, op_end, lit, ip) || op + 3 > op_end)
+            return 0;
+          *op++ = 0x80 | (len - MIN_MATCH);
+          *op++ = ofs & 0xff;
+          *op++ = ofs >> 8;
+          ip += len;
+          lit = ip;
+        }
+      else
+        ip++;
+    }
+  if (!put_literals (&op, op_end, lit, end))
+    return 0;
+
+  return op - dst;
+}
+
+/* Decompresses the SIZE bytes at SRC into the page at DST. */
+static void
+decompress (const uint8_t *src, size_t size, uint8_t *dst)
+{
+  const uint8_t *ip = src, *end = src + size;
+  uint8_t *op = dst;
+
+  while (ip < end)
+    {
+      unsigned t = *ip++;
+      size_t n;
+
+      if (t < 0x80)
+        {
+          n = t + 1;
+          memcpy (op, ip, n);
+          ip += n;
+          op += n;
+        }
+      else
+        {
+          /* Copy a byte at a time: the match may overlap its own
+             output, as a run of zeros does. */
+          const uint8_t *ref = op - (ip[0] | (ip[1] << 8));
+          ip += 2;
+          for (n = (t & 0x7f) + MIN_MATCH; n > 0; n--)
+            *op++ = *ref++;
+        }
+    }
+  ASSERT (op == dst + PGSIZE);
+}
@@ -0,0 +1,20 @@
+#ifndef VM_ZCACHE_H_
+#define VM_ZCACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A compressed copy of one evicted page, kept in kernel memory. */
+struct zcache_entry;
+
+/* Most kernel memory, in pages, the cache may hold. */
+extern size_t zcache_page_limit;
+
+void zcache_init (void);
+struct zcache_entry *zcache_store (const void *page);
+void zcache_dup (struct zcache_entry *);
+void zcache_load (void *page, struct zcache_entry *);
+void zcache_free (struct zcache_entry *);
+void zcache_print_stats (void);
+
+#endif /*VM_ZCACHE_H_*/